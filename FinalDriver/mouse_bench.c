@@ -0,0 +1,300 @@
+// Synthetic load for the mouse logger - creates virtual mice with uinput, injects motion frames
+// and reads them back from the logger to measure throughput, drops and latency.
+// Needs no real mouse: sudo ./mouse_bench [-n mice] [-r frames/s per mouse] [-b burst] [-t seconds]
+//
+// Each frame carries its own identity: REL_X = mouse index + 1, REL_Y = sequence number + 1.
+// The pointer will move while this runs, and frames from a real mouse moved at the same time are ignored.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+// record layout and ioctl commands shared with the driver
+#include "mouse_logger.h"
+
+#define DEVICE_FILE "/dev/mouse_logger_1" // merged view, sees every virtual mouse
+#define MAX_MICE 16
+#define SEQ_WINDOW (1 << 18) // send times kept per mouse, older frames can't be timed
+
+struct bench {
+    int mice;
+    long rate;       // frames per second per mouse, 0 = as fast as possible
+    int burst;       // frames sent back to back before pacing
+    int seconds;
+    const char *device;
+
+    uint64_t *sent_ns;          // [mouse][seq % SEQ_WINDOW] injection time
+    uint64_t sent[MAX_MICE];    // frames injected per mouse
+    uint64_t next_seq[MAX_MICE]; // next sequence number expected back
+    uint64_t received;
+    uint64_t missing;           // gaps in the sequence numbers read back
+    uint64_t lapped;            // events the driver reported as lost with SYN_DROPPED
+    uint64_t *latency;          // injection to read, ns
+    size_t latency_count, latency_size;
+    volatile int stop;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts); // same clock the driver stamps records with
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Creates one virtual mouse with the capabilities the logger matches on
+static int create_mouse(int index) {
+    struct uinput_setup setup;
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+
+    if (fd < 0) return -1;
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_RELBIT, REL_X);
+    ioctl(fd, UI_SET_RELBIT, REL_Y);
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    setup.id.vendor = 0x1234;
+    setup.id.product = 0x5678;
+    snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "mouse_bench %d", index);
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Writes one frame: REL_X, REL_Y and the SYN_REPORT that ends it
+static int inject_frame(int fd, int index, uint64_t seq) {
+    struct input_event ev[3];
+
+    memset(ev, 0, sizeof(ev));
+    ev[0].type = EV_REL;
+    ev[0].code = REL_X;
+    ev[0].value = index + 1;
+    ev[1].type = EV_REL;
+    ev[1].code = REL_Y;
+    ev[1].value = (int32_t)(seq + 1);
+    ev[2].type = EV_SYN;
+    ev[2].code = SYN_REPORT;
+    return write(fd, ev, sizeof(ev)) == sizeof(ev) ? 0 : -1;
+}
+
+static void add_latency(struct bench *b, uint64_t ns) {
+    if (b->latency_count == b->latency_size) {
+        size_t size = b->latency_size ? b->latency_size * 2 : 1 << 16;
+        uint64_t *latency = realloc(b->latency, size * sizeof(*latency));
+
+        if (!latency) return; // out of memory - keep counting, stop timing
+        b->latency = latency;
+        b->latency_size = size;
+    }
+    b->latency[b->latency_count++] = ns;
+}
+
+// Matches one record read back against what was injected
+static void check_record(struct bench *b, const struct mouse_event_record *rec, uint64_t now) {
+    if (rec->type == EV_SYN && rec->code == SYN_DROPPED) {
+        b->lapped += rec->value;
+        return;
+    }
+    if (rec->rel_x < 1 || rec->rel_x > b->mice || rec->rel_y < 1) return; // not ours
+
+    int index = rec->rel_x - 1;
+    uint64_t seq = (uint64_t)rec->rel_y - 1;
+
+    if (seq > b->next_seq[index]) b->missing += seq - b->next_seq[index];
+    b->next_seq[index] = seq + 1;
+    b->received++;
+
+    if (__atomic_load_n(&b->sent[index], __ATOMIC_ACQUIRE) - seq <= SEQ_WINDOW)
+        add_latency(b, now - b->sent_ns[(size_t)index * SEQ_WINDOW + seq % SEQ_WINDOW]);
+}
+
+// Drains the logger until told to stop, in big binary reads
+static void *reader_thread(void *arg) {
+    struct bench *b = arg;
+    static struct mouse_event_record records[4096];
+    struct pollfd pfd = { .events = POLLIN };
+    int format = MOUSE_FMT_BINARY;
+    struct mouse_filter filter = { .kinds = MOUSE_FILTER_MOTION };
+
+    pfd.fd = open(b->device, O_RDONLY | O_NONBLOCK);
+    if (pfd.fd < 0 || ioctl(pfd.fd, MOUSE_LOGGER_SET_FORMAT, &format) < 0 ||
+        ioctl(pfd.fd, MOUSE_LOGGER_SET_FILTER, &filter) < 0) {
+        perror(b->device);
+        exit(1);
+    }
+    ioctl(pfd.fd, MOUSE_LOGGER_CLEAR);
+
+    while (1) {
+        ssize_t bytes_read = read(pfd.fd, records, sizeof(records));
+
+        if (bytes_read > 0) {
+            uint64_t now = now_ns();
+            size_t count = bytes_read / sizeof(records[0]);
+
+            for (size_t i = 0; i < count; i++) check_record(b, &records[i], now);
+            continue;
+        }
+        if (bytes_read < 0 && errno != EAGAIN) {
+            perror("Read failed");
+            exit(1);
+        }
+        if (b->stop) break; // injection is over and the logger is drained
+        poll(&pfd, 1, 100);
+    }
+    close(pfd.fd);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const struct bench *b, double p) {
+    if (!b->latency_count) return 0;
+    return b->latency[(size_t)(p * (b->latency_count - 1))];
+}
+
+static int get_stats(const char *device, struct mouse_stats *stats) {
+    int fd = open(device, O_RDONLY);
+    int ret;
+
+    if (fd < 0) return -1;
+    ret = ioctl(fd, MOUSE_LOGGER_GET_STATS, stats);
+    close(fd);
+    return ret;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-n mice (1-%d)] [-r frames/s per mouse, 0 = max] [-b burst] [-t seconds] [-d device]\n",
+            name, MAX_MICE);
+}
+
+int main(int argc, char *argv[]) {
+    struct bench b = { .mice = 1, .rate = 1000, .burst = 1, .seconds = 5, .device = DEVICE_FILE };
+    struct mouse_stats before, after;
+    int fds[MAX_MICE];
+    pthread_t reader;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:b:t:d:")) != -1) {
+        switch (opt) {
+            case 'n': b.mice = atoi(optarg); break;
+            case 'r': b.rate = atol(optarg); break;
+            case 'b': b.burst = atoi(optarg); break;
+            case 't': b.seconds = atoi(optarg); break;
+            case 'd': b.device = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (b.mice < 1 || b.mice > MAX_MICE || b.rate < 0 || b.burst < 1 || b.seconds < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    b.sent_ns = calloc((size_t)b.mice * SEQ_WINDOW, sizeof(*b.sent_ns));
+    if (!b.sent_ns) {
+        perror("calloc");
+        return 1;
+    }
+
+    for (int i = 0; i < b.mice; i++) {
+        fds[i] = create_mouse(i);
+        if (fds[i] < 0) {
+            perror("Failed to create uinput mouse");
+            return 1;
+        }
+    }
+    sleep(1); // let the input core connect the new mice to the logger
+
+    if (get_stats(b.device, &before) < 0) {
+        perror("Failed to read driver stats");
+        return 1;
+    }
+    if (pthread_create(&reader, NULL, reader_thread, &b)) {
+        fprintf(stderr, "Failed to start reader thread\n");
+        return 1;
+    }
+    usleep(100000); // reader is open and cleared before the first frame
+
+    printf("Injecting on %d mice, %ld frames/s each (bursts of %d) for %d s...\n",
+           b.mice, b.rate, b.burst, b.seconds);
+
+    // Bursts are paced against absolute deadlines, so a slow write doesn't lower the rate
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)b.seconds * 1000000000ull;
+    uint64_t interval = b.rate ? 1000000000ull * b.burst / b.rate : 0;
+    uint64_t deadline = start;
+    uint64_t seq = 0;
+
+    while (now_ns() < end) {
+        for (int k = 0; k < b.burst; k++, seq++) {
+            for (int i = 0; i < b.mice; i++) {
+                b.sent_ns[(size_t)i * SEQ_WINDOW + seq % SEQ_WINDOW] = now_ns();
+                if (inject_frame(fds[i], i, seq) < 0) {
+                    perror("Failed to inject frame");
+                    return 1;
+                }
+                __atomic_store_n(&b.sent[i], seq + 1, __ATOMIC_RELEASE);
+            }
+        }
+        if (interval) {
+            struct timespec ts;
+
+            deadline += interval;
+            ts.tv_sec = deadline / 1000000000ull;
+            ts.tv_nsec = deadline % 1000000000ull;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    usleep(500000); // let the reader catch up with the tail
+    b.stop = 1;
+    pthread_join(reader, NULL);
+    get_stats(b.device, &after);
+
+    for (int i = 0; i < b.mice; i++) {
+        ioctl(fds[i], UI_DEV_DESTROY);
+        close(fds[i]);
+    }
+
+    uint64_t sent = 0;
+    for (int i = 0; i < b.mice; i++) sent += b.sent[i];
+    uint64_t lost = sent > b.received ? sent - b.received : 0;
+
+    qsort(b.latency, b.latency_count, sizeof(*b.latency), cmp_u64);
+
+    printf("sent        %llu frames (%.0f/s)\n", (unsigned long long)sent, sent / elapsed);
+    printf("received    %llu frames (%.0f/s)\n", (unsigned long long)b.received, b.received / elapsed);
+    printf("lost        %llu (%.3f%%), %llu seen as gaps, %llu reported by the driver\n",
+           (unsigned long long)lost, sent ? 100.0 * lost / sent : 0.0,
+           (unsigned long long)b.missing, (unsigned long long)b.lapped);
+    printf("latency     p50 %.1f us  p99 %.1f us  p999 %.1f us  max %.1f us\n",
+           percentile(&b, 0.5) / 1e3, percentile(&b, 0.99) / 1e3, percentile(&b, 0.999) / 1e3,
+           percentile(&b, 1.0) / 1e3);
+    printf("driver      %llu frames, %llu dropped, %llu wakeups, %llu reads\n",
+           (unsigned long long)(after.frames - before.frames), (unsigned long long)(after.dropped - before.dropped),
+           (unsigned long long)(after.wakeups - before.wakeups), (unsigned long long)(after.reads - before.reads));
+
+    free(b.latency);
+    free(b.sent_ns);
+    return lost ? 2 : 0;
+}
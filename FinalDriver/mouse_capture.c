@@ -0,0 +1,397 @@
+// Records the mouse logger into a capture file and replays captures through uinput
+//   sudo ./mouse_capture record file [-t seconds] [-d device]    (Ctrl-C stops recording)
+//   sudo ./mouse_capture replay file [-s speed] [-o offset seconds]
+// speed 1 replays in real time, 10 ten times faster, 0 as fast as possible.
+//
+// Capture file layout - all of it can be mmap'd and used in place:
+//   struct capture_header at offset 0, padded to CAPTURE_DATA_OFFSET
+//   count struct mouse_event_record at CAPTURE_DATA_OFFSET, exactly as the driver returned them
+//   index_count struct capture_index at index_offset, one per CAPTURE_INDEX_INTERVAL records,
+//   so a replay can start at any time without scanning the records before it
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+// record layout and ioctl commands shared with the driver
+#include "mouse_logger.h"
+
+#define DEVICE_FILE "/dev/mouse_logger_1"
+#define CAPTURE_MAGIC "MLCAPTR1"
+#define CAPTURE_DATA_OFFSET 4096
+#define CAPTURE_INDEX_INTERVAL 1024
+#define READ_RECORDS 16384 // records per read while recording
+#define MAX_DEVICES 64     // device ids that get their own virtual mouse on replay
+
+struct capture_header {
+    char magic[8];         // CAPTURE_MAGIC
+    uint32_t abi_version;  // MOUSE_LOGGER_ABI_VERSION of the recorder
+    uint32_t record_size;  // sizeof(struct mouse_event_record)
+    uint64_t count;        // records stored
+    uint64_t lost;         // events the driver reported as lost while recording (0 = lossless)
+    uint64_t first_ns;     // timestamps of the first and last frame
+    uint64_t last_ns;
+    uint64_t index_offset; // bytes from the start of the file
+    uint64_t index_count;
+};
+
+struct capture_index {
+    uint64_t timestamp_ns; // of record number record
+    uint64_t record;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int is_frame(const struct mouse_event_record *rec) {
+    return rec->type == EV_SYN && rec->code == SYN_REPORT;
+}
+
+// Drains the logger into path until Ctrl-C or seconds have passed
+static int record(const char *path, const char *device, int seconds) {
+    static struct mouse_event_record records[READ_RECORDS];
+    struct mouse_wakeup_config wakeup = { .watermark = 1024, .timeout_us = 20000 };
+    struct capture_header hdr = { .abi_version = MOUSE_LOGGER_ABI_VERSION, .record_size = sizeof(records[0]) };
+    struct capture_index *index = NULL;
+    size_t index_size = 0;
+    int format = MOUSE_FMT_BINARY;
+    int ret = 0;
+
+    int dev = open(device, O_RDONLY);
+    if (dev < 0 || ioctl(dev, MOUSE_LOGGER_SET_FORMAT, &format) < 0 || ioctl(dev, MOUSE_LOGGER_SET_WAKEUP, &wakeup) < 0) {
+        perror(device);
+        return 1;
+    }
+    ioctl(dev, MOUSE_LOGGER_CLEAR); // only what happens from now on
+
+    int out = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out < 0 || lseek(out, CAPTURE_DATA_OFFSET, SEEK_SET) < 0) {
+        perror(path);
+        return 1;
+    }
+
+    // no SA_RESTART, so Ctrl-C interrupts a blocked read
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (seconds) {
+        // the alarm interrupts a blocked read just like Ctrl-C
+        sigaction(SIGALRM, &sa, NULL);
+        alarm(seconds);
+    }
+
+    fprintf(stderr, "Recording %s to %s...\n", device, path);
+    while (!stop) {
+        ssize_t n = read(dev, records, sizeof(records));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Read failed");
+            ret = 1;
+            break;
+        } else if (n == 0) {
+            break; // the mouse behind a per device node was unplugged
+        }
+
+        size_t count = n / sizeof(records[0]);
+        for (size_t i = 0; i < count; i++) {
+            const struct mouse_event_record *rec = &records[i];
+            uint64_t pos = hdr.count + i;
+
+            if (rec->type == EV_SYN && rec->code == SYN_DROPPED) hdr.lost += rec->value;
+            if (is_frame(rec)) {
+                if (!hdr.first_ns) hdr.first_ns = rec->timestamp_ns;
+                hdr.last_ns = rec->timestamp_ns;
+            }
+            if (pos % CAPTURE_INDEX_INTERVAL == 0) {
+                if (hdr.index_count == index_size) {
+                    index_size = index_size ? index_size * 2 : 1024;
+                    index = realloc(index, index_size * sizeof(*index));
+                    if (!index) {
+                        perror("realloc");
+                        return 1;
+                    }
+                }
+                index[hdr.index_count].timestamp_ns = rec->timestamp_ns;
+                index[hdr.index_count].record = pos;
+                hdr.index_count++;
+            }
+        }
+        if (write_all(out, records, count * sizeof(records[0])) < 0) {
+            perror("Write failed");
+            ret = 1;
+            break;
+        }
+        hdr.count += count;
+    }
+
+    // index after the records, then the header - a capture without its header is never valid
+    hdr.index_offset = CAPTURE_DATA_OFFSET + hdr.count * sizeof(struct mouse_event_record);
+    memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+    if (write_all(out, index, hdr.index_count * sizeof(*index)) < 0 || pwrite(out, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        perror("Failed to finish capture");
+        ret = 1;
+    }
+
+    fprintf(stderr, "Recorded %llu records over %.1f s", (unsigned long long)hdr.count,
+            hdr.last_ns > hdr.first_ns ? (hdr.last_ns - hdr.first_ns) / 1e9 : 0.0);
+    if (hdr.lost) fprintf(stderr, ", %llu events LOST (raise ring_capacity)", (unsigned long long)hdr.lost);
+    fprintf(stderr, "\n");
+
+    free(index);
+    close(out);
+    close(dev);
+    return ret;
+}
+
+// Creates a virtual mouse with every button and axis a record can hold
+static int create_mouse(unsigned int device_id) {
+    struct uinput_setup setup;
+    int fd = open("/dev/uinput", O_WRONLY);
+
+    if (fd < 0) return -1;
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    for (int code = BTN_MOUSE; code <= BTN_TASK; code++) ioctl(fd, UI_SET_KEYBIT, code);
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_RELBIT, REL_X);
+    ioctl(fd, UI_SET_RELBIT, REL_Y);
+    ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
+    ioctl(fd, UI_SET_RELBIT, REL_HWHEEL);
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    setup.id.vendor = 0x1234;
+    setup.id.product = 0x5679;
+    snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "mouse_capture replay %u", device_id);
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void put_event(struct input_event *ev, int *n, int type, int code, int value) {
+    memset(&ev[*n], 0, sizeof(ev[0]));
+    ev[*n].type = type;
+    ev[*n].code = code;
+    ev[*n].value = value;
+    (*n)++;
+}
+
+// Turns one frame record back into the input events that produced it
+static int inject_frame(int fd, const struct mouse_event_record *rec) {
+    struct input_event ev[2 * 8 + 5];
+    int n = 0;
+
+    // A button both pressed and released in one frame was clicked (press first) if it ends up
+    // released, or let go and pressed again (release first) if it is still held after the frame
+    for (int i = 0; i < 8; i++) {
+        int held = rec->buttons & (1u << i);
+
+        if (!held && (rec->pressed & (1u << i))) put_event(ev, &n, EV_KEY, BTN_MOUSE + i, 1);
+        if (rec->released & (1u << i)) put_event(ev, &n, EV_KEY, BTN_MOUSE + i, 0);
+        if (held && (rec->pressed & (1u << i))) put_event(ev, &n, EV_KEY, BTN_MOUSE + i, 1);
+    }
+    if (rec->rel_x) put_event(ev, &n, EV_REL, REL_X, rec->rel_x);
+    if (rec->rel_y) put_event(ev, &n, EV_REL, REL_Y, rec->rel_y);
+    if (rec->wheel) put_event(ev, &n, EV_REL, REL_WHEEL, rec->wheel);
+    if (rec->hwheel) put_event(ev, &n, EV_REL, REL_HWHEEL, rec->hwheel);
+    put_event(ev, &n, EV_SYN, SYN_REPORT, 0);
+
+    return write_all(fd, ev, n * sizeof(ev[0]));
+}
+
+// First record at or after offset_ns into the capture, found through the index
+static uint64_t seek_record(const struct capture_header *hdr, const struct capture_index *index,
+                            const struct mouse_event_record *records, uint64_t offset_ns) {
+    uint64_t target = hdr->first_ns + offset_ns;
+    uint64_t lo = 0, hi = hdr->index_count, pos;
+
+    while (lo < hi) { // last index entry before target
+        uint64_t mid = (lo + hi) / 2;
+        if (index[mid].timestamp_ns < target) lo = mid + 1;
+        else hi = mid;
+    }
+    pos = lo ? index[lo - 1].record : 0;
+    while (pos < hdr->count && (!is_frame(&records[pos]) || records[pos].timestamp_ns < target)) pos++;
+    return pos;
+}
+
+// True if the header describes a capture that fits in size bytes: the records from
+// CAPTURE_DATA_OFFSET on, then the index. Written so corrupt counts can't overflow the checks.
+static int capture_valid(const struct capture_header *hdr, uint64_t size) {
+    if (size < CAPTURE_DATA_OFFSET || memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) ||
+        hdr->record_size != sizeof(struct mouse_event_record))
+        return 0;
+    if (hdr->count > (size - CAPTURE_DATA_OFFSET) / hdr->record_size) return 0; // records cut off
+    if (hdr->index_offset < CAPTURE_DATA_OFFSET + hdr->count * hdr->record_size ||
+        hdr->index_offset > size || hdr->index_offset % sizeof(uint64_t))
+        return 0; // index overlaps the records or lies outside the file
+    return hdr->index_count <= (size - hdr->index_offset) / sizeof(struct capture_index);
+}
+
+// Replays a capture through one virtual mouse per recorded device
+static int replay(const char *path, double speed, double offset) {
+    int mice[MAX_DEVICES];
+    struct stat st;
+    int ret = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    if ((size_t)st.st_size < CAPTURE_DATA_OFFSET) { // too short to even hold the header
+        fprintf(stderr, "%s is not a complete capture\n", path);
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Failed to map capture");
+        close(fd);
+        return 1;
+    }
+
+    const struct capture_header *hdr = map;
+    if (!capture_valid(hdr, st.st_size)) {
+        fprintf(stderr, "%s is not a complete capture\n", path);
+        munmap(map, st.st_size);
+        close(fd);
+        return 1;
+    }
+    const struct mouse_event_record *records = (const void *)((const char *)map + CAPTURE_DATA_OFFSET);
+    const struct capture_index *index = (const void *)((const char *)map + hdr->index_offset);
+    madvise((void *)records, hdr->count * sizeof(*records), MADV_SEQUENTIAL);
+
+    for (int i = 0; i < MAX_DEVICES; i++) mice[i] = -1;
+
+    uint64_t pos = seek_record(hdr, index, records, (uint64_t)(offset * 1e9));
+    uint64_t first = pos < hdr->count ? records[pos].timestamp_ns : 0;
+    uint64_t frames = 0;
+
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+
+    fprintf(stderr, "Replaying %llu records from %s at %s...\n", (unsigned long long)(hdr->count - pos), path,
+            speed > 0 ? "recorded pace" : "full speed");
+
+    // virtual mice are created up front, so creating them doesn't delay the first frames
+    for (uint64_t i = pos; i < hdr->count; i++) {
+        unsigned int id = records[i].device_id % MAX_DEVICES;
+        if (!is_frame(&records[i]) || mice[id] >= 0) continue;
+        mice[id] = create_mouse(records[i].device_id);
+        if (mice[id] < 0) {
+            perror("Failed to create uinput mouse");
+            ret = 1;
+            goto out; // the mice created so far go away again
+        }
+    }
+    sleep(1); // let the input core hand the new mice to its handlers
+
+    uint64_t start = now_ns();
+    for (; pos < hdr->count && !stop; pos++) {
+        const struct mouse_event_record *rec = &records[pos];
+        if (!is_frame(rec)) continue; // SYN_DROPPED markers have nothing to replay
+
+        if (speed > 0) {
+            // absolute deadlines, so time spent injecting doesn't add up. Records of different mice
+            // can be a little out of order (or before first after an offset seek) - those go out at once
+            int64_t since_first = (int64_t)(rec->timestamp_ns - first);
+            uint64_t due = start + (uint64_t)((since_first > 0 ? since_first : 0) / speed);
+            struct timespec ts = { .tv_sec = due / 1000000000ull, .tv_nsec = due % 1000000000ull };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+        if (inject_frame(mice[rec->device_id % MAX_DEVICES], rec) < 0) {
+            perror("Failed to inject frame");
+            ret = 1;
+            break;
+        }
+        frames++;
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    fprintf(stderr, "Replayed %llu frames in %.2f s (%.0f frames/s)\n", (unsigned long long)frames, elapsed,
+            elapsed > 0 ? frames / elapsed : 0.0);
+
+out:
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (mice[i] < 0) continue;
+        ioctl(mice[i], UI_DEV_DESTROY);
+        close(mice[i]);
+    }
+    munmap(map, st.st_size);
+    close(fd);
+    return ret;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s record file [-t seconds] [-d device]\n"
+                    "       %s replay file [-s speed, 0 = max] [-o offset seconds]\n", name, name);
+}
+
+int main(int argc, char *argv[]) {
+    const char *device = DEVICE_FILE;
+    double speed = 1.0, offset = 0;
+    int seconds = 0;
+    int opt;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    optind = 3;
+    while ((opt = getopt(argc, argv, "t:d:s:o:")) != -1) {
+        switch (opt) {
+            case 't': seconds = atoi(optarg); break;
+            case 'd': device = optarg; break;
+            case 's': speed = atof(optarg); break;
+            case 'o': offset = atof(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    if (strcmp(argv[1], "record") == 0) return record(argv[2], device, seconds);
+    if (strcmp(argv[1], "replay") == 0) return replay(argv[2], speed, offset);
+    usage(argv[0]);
+    return 1;
+}
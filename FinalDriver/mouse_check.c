@@ -0,0 +1,270 @@
+// Behaviour checks for the mouse logger - creates virtual mice with uinput, drives them and checks
+// what their logger nodes return. Needs the module loaded and no real mouse: sudo ./mouse_check
+// Prints one PASS / FAIL line per check, exit status is the number of failed checks.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+// record layout and ioctl commands shared with the driver
+#include "mouse_logger.h"
+
+#define DEVICES_FILE "/sys/class/mouse_logger_1/mouse_logger_1/devices"
+#define DISABLE_FILE "/sys/class/mouse_logger_1/mouse_logger_1/disable"
+#define MERGED_FILE "/dev/mouse_logger_1"
+#define CHECK_TIMEOUT 5 // seconds one check may take before it counts as hung
+
+static const char *current_check;
+
+static void on_alarm(int sig) {
+    (void)sig;
+    fprintf(stderr, "FAIL %s: hung\n", current_check);
+    _exit(1);
+}
+
+// Creates a virtual mouse with the capabilities the logger matches on
+static int create_mouse(const char *name) {
+    struct uinput_setup setup;
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+
+    if (fd < 0) return -1;
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_RELBIT, REL_X);
+    ioctl(fd, UI_SET_RELBIT, REL_Y);
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    setup.id.vendor = 0x1234;
+    setup.id.product = 0x567a;
+    snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "%s", name);
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void destroy_mouse(int fd) {
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+}
+
+// Finds the logger id and node of the device called name, waiting for the input core to connect it
+static int find_node(const char *name, char *node, size_t size) {
+    for (int tries = 0; tries < 50; tries++) {
+        FILE *f = fopen(DEVICES_FILE, "r");
+        char line[256], dev[48];
+        unsigned int id;
+        int enabled, pos;
+
+        if (!f) return -1;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "%u %d %47s %n", &id, &enabled, dev, &pos) < 3) continue;
+            line[strcspn(line, "\n")] = 0;
+            if (strcmp(line + pos, name)) continue;
+            fclose(f);
+            snprintf(node, size, "/dev/%s", dev);
+            usleep(100000); // udev creates the node right after the device shows up
+            return id;
+        }
+        fclose(f);
+        usleep(100000);
+    }
+    return -1;
+}
+
+// Writes the events of one frame followed by SYN_REPORT
+static int send_frame(int fd, int button, int x, int y) {
+    struct input_event ev[4];
+    int n = 0;
+
+    memset(ev, 0, sizeof(ev));
+    if (button >= 0) {
+        ev[n].type = EV_KEY;
+        ev[n].code = BTN_LEFT;
+        ev[n++].value = button;
+    }
+    if (x) {
+        ev[n].type = EV_REL;
+        ev[n].code = REL_X;
+        ev[n++].value = x;
+    }
+    if (y) {
+        ev[n].type = EV_REL;
+        ev[n].code = REL_Y;
+        ev[n++].value = y;
+    }
+    ev[n].type = EV_SYN;
+    ev[n++].code = SYN_REPORT;
+    return write(fd, ev, n * sizeof(ev[0])) == (ssize_t)(n * sizeof(ev[0])) ? 0 : -1;
+}
+
+// Opens the node of a fresh virtual mouse for binary reads
+static int open_logger(const char *name, int flags, int *mouse) {
+    int format = MOUSE_FMT_BINARY;
+    char node[64];
+    int fd;
+
+    *mouse = create_mouse(name);
+    if (*mouse < 0) {
+        perror("Failed to create uinput mouse");
+        exit(1);
+    }
+    if (find_node(name, node, sizeof(node)) < 0) {
+        fprintf(stderr, "%s never showed up in " DEVICES_FILE " - is the module loaded?\n", name);
+        exit(1);
+    }
+    fd = open(node, O_RDONLY | flags);
+    if (fd < 0 || ioctl(fd, MOUSE_LOGGER_SET_FORMAT, &format) < 0) {
+        perror(node);
+        exit(1);
+    }
+    return fd;
+}
+
+static int result(int ok, const char *why) {
+    if (ok) printf("PASS %s\n", current_check);
+    else printf("FAIL %s: %s\n", current_check, why);
+    return !ok;
+}
+
+// A non-blocking read below the watermark must say EAGAIN right away, never wait for more events
+static int check_nonblock_watermark(void) {
+    struct mouse_wakeup_config wakeup = { .watermark = 8, .timeout_us = 0 };
+    struct mouse_event_record records[16];
+    struct pollfd pfd = { .events = POLLIN };
+    const char *why = NULL;
+    int mouse, fd;
+    ssize_t n;
+
+    current_check = "non-blocking read below the watermark";
+    fd = open_logger("mouse_check nonblock", O_NONBLOCK, &mouse);
+    ioctl(fd, MOUSE_LOGGER_SET_WAKEUP, &wakeup);
+    pfd.fd = fd;
+
+    send_frame(mouse, -1, 1, 1);
+    usleep(50000);
+    n = read(fd, records, sizeof(records));
+    if (n >= 0 || errno != EAGAIN) why = "1 of 8 events pending did not give EAGAIN";
+    else if (poll(&pfd, 1, 0) != 0) why = "poll says readable below the watermark";
+
+    if (!why) {
+        for (int i = 0; i < 7; i++) send_frame(mouse, -1, 1, 1);
+        usleep(50000);
+        n = read(fd, records, sizeof(records));
+        if (n != 8 * (ssize_t)sizeof(records[0])) why = "8 of 8 events pending were not returned";
+    }
+    close(fd);
+    destroy_mouse(mouse);
+    return result(!why, why);
+}
+
+// With accumulate 4, fewer pending frames come back as one partial sum instead of being held,
+// and the last partial sum before the mouse is unplugged comes back before EOF
+static int check_accumulate_partial(void) {
+    struct mouse_filter filter = { .kinds = MOUSE_FILTER_ALL, .accumulate = 4 };
+    struct mouse_event_record records[16];
+    const char *why = NULL;
+    int mouse, fd;
+    ssize_t n;
+
+    current_check = "partial accumulation is returned";
+    fd = open_logger("mouse_check accumulate", 0, &mouse);
+    ioctl(fd, MOUSE_LOGGER_SET_FILTER, &filter);
+
+    for (int i = 0; i < 2; i++) send_frame(mouse, -1, 1, 1);
+    usleep(50000);
+    n = read(fd, records, sizeof(records));
+    if (n != sizeof(records[0]) || records[0].rel_x != 2) why = "2 of 4 frames were not returned as one record";
+
+    if (!why) {
+        for (int i = 0; i < 3; i++) send_frame(mouse, -1, 1, 1);
+        destroy_mouse(mouse);
+        mouse = -1;
+        n = read(fd, records, sizeof(records));
+        if (n != sizeof(records[0]) || records[0].rel_x != 3) why = "frames summed before unplug were lost";
+        else if (read(fd, records, sizeof(records)) != 0) why = "no EOF after the last record";
+    }
+    close(fd);
+    if (mouse >= 0) destroy_mouse(mouse);
+    return result(!why, why);
+}
+
+// Left button held in entry id and in entry 0 of the state page
+static int left_held(int id, int *all) {
+    struct mouse_state_page state;
+    int fd = open(MERGED_FILE, O_RDONLY);
+
+    if (fd < 0 || ioctl(fd, MOUSE_LOGGER_GET_STATE, &state) < 0) {
+        perror(MERGED_FILE);
+        exit(1);
+    }
+    close(fd);
+    *all = !!(state.dev[0].buttons & MOUSE_BTN_LEFT);
+    return !!(state.dev[id].buttons & MOUSE_BTN_LEFT);
+}
+
+// A mouse unplugged or disabled with the left button down must not leave it held in the state
+// page - its release never arrives
+static int check_state_buttons_dropped(void) {
+    const char *why = NULL;
+    char node[64];
+    int mouse, id, all;
+    FILE *f;
+
+    current_check = "held buttons dropped on unplug and disable";
+    for (int disable = 0; disable < 2 && !why; disable++) {
+        mouse = create_mouse("mouse_check buttons");
+        if (mouse < 0 || (id = find_node("mouse_check buttons", node, sizeof(node))) < 0) {
+            fprintf(stderr, "Failed to connect a virtual mouse\n");
+            exit(1);
+        }
+        send_frame(mouse, 1, 0, 0);
+        usleep(50000);
+        if (!left_held(id, &all) || !all) why = "press did not show up in the state page";
+
+        if (!why && disable) {
+            f = fopen(DISABLE_FILE, "w");
+            if (!f || fprintf(f, "%d\n", id) < 0 || fclose(f)) {
+                perror(DISABLE_FILE);
+                exit(1);
+            }
+            if (left_held(id, &all) || all) why = "button still held after disable";
+        }
+        destroy_mouse(mouse);
+        usleep(100000);
+        if (!why && (left_held(id, &all) || all)) why = "button still held after unplug";
+    }
+    return result(!why, why);
+}
+
+int main(void) {
+    struct sigaction sa = { .sa_handler = on_alarm };
+    int (*checks[])(void) = {
+        check_nonblock_watermark,
+        check_accumulate_partial,
+        check_state_buttons_dropped,
+    };
+    int failed = 0;
+
+    sigaction(SIGALRM, &sa, NULL);
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        alarm(CHECK_TIMEOUT);
+        failed += checks[i]();
+        alarm(0);
+    }
+    return failed;
+}
@@ -8,13 +8,37 @@
 #include <linux/wait.h>   
 #include <linux/ioctl.h>  
 #include <linux/proc_fs.h> 
+#include <linux/slab.h>
+#include <linux/idr.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <linux/rcupdate.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/hrtimer.h>
+#include <linux/kref.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/jump_label.h>
+
+// record layout and ioctl commands shared with userapp.c
+#include "mouse_logger.h"
+// the event ring and text rendering
+#include "mouse_ring.h"
+
+// tracepoints (mouse_logger:*), defined in this file
+#define CREATE_TRACE_POINTS
+#include "mouse_trace.h"
 
 // constants for creating dev and proc files
-#define DEVICE_NAME "mouse_logger_1"
+#define DEVICE_NAME "mouse_logger_1" // merged view of all devices, minor 0
+#define DEVICE_NAME_FMT "mouse_logger_%d" // per device nodes are named after minor + 1
 #define PROC_FILE_NAME "mouse_events"
-
-// Declaring ioctl command to clear buffer - M is magic number
-#define MOUSE_LOGGER_CLEAR _IO('M', 1)
+#define PROC_STATS_NAME "mouse_stats"
+#define MOUSE_MINORS 32 // merged view plus up to 31 connected mice
+#define READ_BATCH_SIZE PAGE_SIZE // records are rendered here under the ring lock, then copied out without it
+#define READ_BATCH_STAMPS 64 // frames per batch whose latency is measured, while timing is on
 
 // variables for device registration, used in init function
 static int major_number;
@@ -22,169 +46,1362 @@ static struct cdev mouse_cdev;
 static struct class *mouse_class;
 static struct input_handler mouse_handler;
 
-// Buffer for mouse events
-#define BUFFER_SIZE 256
-static char event_buffer[BUFFER_SIZE];
-static int buffer_pos = 0;
-static DEFINE_MUTEX(buffer_lock); // Mutex makes sure user app doesn't read before driver is done writing
+static unsigned int ring_capacity = 4096;
+module_param(ring_capacity, uint, 0444);
+MODULE_PARM_DESC(ring_capacity, "Number of event records kept (rounded up to a power of two)");
+
+// Per CPU counters, so the event path never shares a cache line with another CPU.
+// They are only summed when someone asks for them.
+struct mouse_cpu_stats {
+    u64 events;
+    u64 frames;
+    u64 filtered;
+    u64 dropped;
+    u64 reads;
+    u64 bytes_copied;
+    u64 wakeups;
+    u64 handler_ns;
+    u64 log_ns;
+    u64 log_hist[MOUSE_STATS_BUCKETS];
+    u64 latency_hist[MOUSE_STATS_BUCKETS];
+};
+static DEFINE_PER_CPU(struct mouse_cpu_stats, mouse_cpu_stats);
+
+#define stat_add(field, n) this_cpu_add(mouse_cpu_stats.field, n)
+#define stat_inc(field) this_cpu_inc(mouse_cpu_stats.field)
+#define stat_hist(field, ns) this_cpu_inc(mouse_cpu_stats.field[stat_bucket(ns)])
+
+// Reading the clock is the expensive part, so timing is patched out of the code unless switched on
+static DEFINE_STATIC_KEY_FALSE(mouse_timing);
+
+static int stat_bucket(u64 ns) {
+    return ns ? min(ilog2(ns), MOUSE_STATS_BUCKETS - 1) : 0;
+}
+
+static int timing_set(const char *val, const struct kernel_param *kp) {
+    bool on;
+    int ret = kstrtobool(val, &on);
+
+    if (ret) return ret;
+    if (on) static_branch_enable(&mouse_timing);
+    else static_branch_disable(&mouse_timing);
+    return 0;
+}
+
+static int timing_get(char *buf, const struct kernel_param *kp) {
+    return sprintf(buf, "%d\n", static_key_enabled(&mouse_timing));
+}
+
+static const struct kernel_param_ops timing_ops = {
+    .set = timing_set,
+    .get = timing_get,
+};
+module_param_cb(timing, &timing_ops, NULL, 0644);
+MODULE_PARM_DESC(timing, "Time the event path and reads for the stats histograms (default off)");
+
+// One readable stream of events with its own ring, wait queue and device node.
+// Minor 0 is the merged view of every device (/dev/mouse_logger_1); each connected mouse gets
+// its own stream on the next free minor, so busy devices never share a ring.
+struct mouse_stream {
+    struct mouse_ring __rcu *ring; // swapped with RCU on resize, so producers never wait on one
+    struct rw_semaphore sem; // readers share it, resizes take it exclusively - producers never take it
+    u32 generation; // generation of the newest ring, only changed under sem
+    atomic64_t dropped; // records overwritten before a reader got to them
+    atomic_t mmaps; // live mappings of the ring, which can't be resized while mapped
+    // Wait queue for blocking read operations - process is put to sleep if there is no data
+    wait_queue_head_t wait;
+    struct fasync_struct *fasync; // readers that asked for SIGIO
+    // Lowest ring position any sleeping reader needs to be woken for (S64_MAX = nobody).
+    // Readers lower it before sleeping; producers only touch the wait queue once it is reached,
+    // so a reader batching N events costs one wakeup instead of N.
+    atomic64_t wake_pos;
+    unsigned int minor;
+    bool dead; // device disconnected - readers get EOF once they have drained the ring
+    struct kref ref; // held by the connected device and by every open file
+};
 
-// Wait queue for blocking read operations - process is put to sleep if there is no data
-static DECLARE_WAIT_QUEUE_HEAD(mouse_wait_queue);
-static int data_available = 0; // Flag to indicate there is data to read
+static struct mouse_stream *merged_stream; // minor 0, every device logs here too
+static struct mouse_stream *mouse_streams[MOUSE_MINORS]; // by minor, under mouse_devs_lock
+
+// Latest state of every device, one vmalloc_user() page that user space maps read-only.
+// A device's entry is only written from its own event path (the input core delivers one device's
+// events one at a time) or while it can't send any, so it needs no lock. Entry 0 is shared by all
+// devices and its writers take state_all_lock. Readers use the per entry seq.
+static struct mouse_state_page *mouse_state;
+static DEFINE_SPINLOCK(state_all_lock);
 
 // stores location of proc file
 static struct proc_dir_entry *proc_file;
+static struct proc_dir_entry *proc_stats_file;
+
+// Per connected input device - the handle is embedded so callbacks can find the id
+struct mouse_dev {
+    struct input_handle handle;
+    u16 id; // also the minor of this device's stream
+    struct mouse_stream *stream;
+    struct mouse_event_record frame; // collects the current frame until SYN_REPORT
+    bool frame_dirty; // frame has something worth logging
+    bool enabled; // input device is open and sending us events
+    struct list_head node; // in mouse_devs
+};
+static DEFINE_IDA(mouse_ida); // hands out device ids / minors
+static LIST_HEAD(mouse_devs); // connected devices, listed in sysfs
+static DEFINE_MUTEX(mouse_devs_lock);
+
+// Per open file state - every reader has its own cursor, so readers never steal each other's events
+struct mouse_reader {
+    struct mutex lock; // serializes threads sharing one open file
+    struct mouse_stream *stream; // what this file reads
+    int format; // MOUSE_FMT_*
+    struct compact_state compact; // deltas of the MOUSE_FMT_COMPACT stream handed out so far
+    u64 cursor; // next ring position this reader returns
+    u64 lost; // events skipped after being lapped, reported before the next record
+    u32 generation; // ring generation the cursor belongs to
+    u32 watermark; // wake once this many events are pending...
+    u32 timeout_us; // ...or this long after the first unread event (0 = no timeout)
+    struct hrtimer timer; // fires timeout_us after the first unread event
+    bool timer_expired;
+    struct mouse_filter filter; // what this reader wants to see (MOUSE_LOGGER_SET_FILTER)
+    struct mouse_event_record acc; // motion summed over filter.accumulate frames
+    u32 acc_frames;
+    bool acc_flush; // hand acc out before taking more frames (the filter changed)
+    struct mouse_event_record next; // record reader_peek() produced, until it is consumed
+    bool has_next;
+    char *batch; // READ_BATCH_SIZE bytes, what one pass of mouse_read() copies to the user
+    u64 stamps[READ_BATCH_STAMPS]; // timestamps of the frames in batch, for the latency histogram
+};
+
+// Where a reader stood before it rendered a batch - put back if copying the batch out faults,
+// so those records are returned by the next read instead of being lost
+struct reader_pos {
+    u64 cursor;
+    u64 lost;
+    u32 generation;
+    struct compact_state compact;
+    struct mouse_event_record acc;
+    u32 acc_frames;
+    bool acc_flush;
+    struct mouse_event_record next;
+    bool has_next;
+};
+
+static void reader_save(const struct mouse_reader *reader, struct reader_pos *pos) {
+    pos->cursor = reader->cursor;
+    pos->lost = reader->lost;
+    pos->generation = reader->generation;
+    pos->compact = reader->compact;
+    pos->acc = reader->acc;
+    pos->acc_frames = reader->acc_frames;
+    pos->acc_flush = reader->acc_flush;
+    pos->next = reader->next;
+    pos->has_next = reader->has_next;
+}
+
+static void reader_restore(struct mouse_reader *reader, const struct reader_pos *pos) {
+    reader->cursor = pos->cursor;
+    reader->lost = pos->lost;
+    reader->generation = pos->generation;
+    reader->compact = pos->compact;
+    reader->acc = pos->acc;
+    reader->acc_frames = pos->acc_frames;
+    reader->acc_flush = pos->acc_flush;
+    reader->next = pos->next;
+    reader->has_next = pos->has_next;
+}
+
+// Function to log mouse events into the ring
+// Called from the input .events callback in atomic context - wait-free, never sleeps or allocates
+static void log_event(struct mouse_stream *stream, const struct mouse_event_record *rec) {
+    struct mouse_ring *ring;
+    u64 pos, start = 0;
+
+    if (static_branch_unlikely(&mouse_timing)) start = ktime_get_ns();
+
+    rcu_read_lock();
+    ring = rcu_dereference(stream->ring);
+    pos = ring_push(ring, rec);
+    trace_mouse_enqueue(stream->minor, rec, pos, ring->capacity);
+    if (pos >= ring->capacity) trace_mouse_evict(stream->minor, pos - ring->capacity);
+    rcu_read_unlock();
+
+    // Wakes up waiting read processes once a reader's wake position is reached
+    // (the barrier orders the publish against reading wake_pos, pairs with wake_arm())
+    smp_mb();
+    if ((s64)pos >= atomic64_read(&stream->wake_pos)) {
+        atomic64_set(&stream->wake_pos, S64_MAX); // woken readers that still need more re-arm
+        wake_up_interruptible(&stream->wait);
+        stat_inc(wakeups);
+        trace_mouse_wake(stream->minor, pos);
+    }
+    kill_fasync(&stream->fasync, SIGIO, POLL_IN);
+
+    if (static_branch_unlikely(&mouse_timing)) {
+        u64 ns = ktime_get_ns() - start;
+
+        stat_add(log_ns, ns);
+        stat_hist(log_hist, ns);
+    }
+}
+
+// Replaces the ring with one of a new capacity - unread records are dropped
+static int ring_resize(struct mouse_stream *stream, unsigned int capacity) {
+    struct mouse_ring *new_ring, *old_ring;
+
+    down_write(&stream->sem);
+    if (atomic_read(&stream->mmaps)) {
+        up_write(&stream->sem);
+        return -EBUSY;
+    }
+
+    new_ring = ring_alloc(capacity, stream->generation + 1);
+    if (!new_ring) {
+        up_write(&stream->sem);
+        return -ENOMEM;
+    }
+    stream->generation++;
+    old_ring = rcu_dereference_protected(stream->ring, lockdep_is_held(&stream->sem));
+    rcu_assign_pointer(stream->ring, new_ring);
+    synchronize_rcu(); // no producer is still writing into old_ring after this
+    up_write(&stream->sem);
+
+    ring_free(old_ring);
+    atomic64_set(&stream->wake_pos, S64_MAX); // positions restart in the new ring
+    wake_up_interruptible(&stream->wait); // sleeping readers must move to the new ring
+    printk(KERN_INFO "Mouse Logger: Ring resized to %u records\n", new_ring->capacity);
+    return 0;
+}
+
+// Creates a stream with an empty ring, holding one reference for the caller
+static struct mouse_stream *stream_create(unsigned int minor) {
+    struct mouse_stream *stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+    struct mouse_ring *ring;
+
+    if (!stream) return NULL;
+    ring = ring_alloc(ring_capacity, 0);
+    if (!ring) {
+        kfree(stream);
+        return NULL;
+    }
+    RCU_INIT_POINTER(stream->ring, ring);
+    init_rwsem(&stream->sem);
+    init_waitqueue_head(&stream->wait);
+    atomic64_set(&stream->wake_pos, S64_MAX);
+    stream->minor = minor;
+    kref_init(&stream->ref);
+    return stream;
+}
+
+static void stream_release(struct kref *ref) {
+    struct mouse_stream *stream = container_of(ref, struct mouse_stream, ref);
+
+    ring_free(rcu_dereference_protected(stream->ring, 1));
+    kfree(stream);
+}
+
+static void stream_put(struct mouse_stream *stream) {
+    kref_put(&stream->ref, stream_release);
+}
+
+// Called when the device behind a stream goes away - readers drain what is left, then get EOF
+static void stream_kill(struct mouse_stream *stream) {
+    WRITE_ONCE(stream->dead, true);
+    wake_up_interruptible(&stream->wait);
+    kill_fasync(&stream->fasync, SIGIO, POLL_HUP);
+}
+
+// Begins / ends an update of one state entry - readers retry while seq is odd or has moved
+static void state_write_begin(struct mouse_device_state *st) {
+    WRITE_ONCE(st->seq, st->seq + 1);
+    smp_wmb();
+}
+
+static void state_write_end(struct mouse_device_state *st) {
+    smp_wmb();
+    WRITE_ONCE(st->seq, st->seq + 1);
+}
+
+// Buttons held on any device, for entry 0 - called with state_all_lock held
+static u16 state_held_buttons(void) {
+    u16 buttons = 0;
+    int i;
+
+    for (i = 1; i < MOUSE_STATE_DEVICES; i++) buttons |= READ_ONCE(mouse_state->dev[i].buttons);
+    return buttons;
+}
+
+// Redoes entry 0's buttons after a device's buttons were cleared without a frame
+static void state_update_all_buttons(void) {
+    struct mouse_device_state *all = &mouse_state->dev[0];
+    unsigned long flags;
+
+    spin_lock_irqsave(&state_all_lock, flags);
+    state_write_begin(all);
+    WRITE_ONCE(all->buttons, state_held_buttons());
+    state_write_end(all);
+    spin_unlock_irqrestore(&state_all_lock, flags);
+}
+
+// Starts a fresh entry for a newly connected device, or marks it gone. Only called while the
+// device can't deliver events (before its handle is registered / after it is unregistered).
+// A device that goes away holds nothing any more - its releases will never arrive.
+static void state_set_connected(u16 id, bool connected) {
+    struct mouse_device_state *st = &mouse_state->dev[id];
+
+    preempt_disable(); // keep the odd seq window short, readers spin on it
+    state_write_begin(st);
+    if (connected) {
+        st->x = st->y = st->wheel = st->hwheel = 0;
+        st->frames = 0;
+        st->timestamp_ns = 0;
+    }
+    WRITE_ONCE(st->buttons, 0);
+    st->connected = connected;
+    state_write_end(st);
+    preempt_enable();
+
+    if (!connected) state_update_all_buttons();
+}
 
-// Function to log mouse events into the buffer
-static void log_event(const char *event) {
-    mutex_lock(&buffer_lock); 
-    int event_len = strlen(event) + 1;  
-
-    // FIFO - removes oldest entry when buffer is full (rarely used - buffer is cleared on every read anyways)
-    while (buffer_pos + event_len >= BUFFER_SIZE) {
-        // Uses the "\n" character to identify first entry
-        char *oldest_event = strchr(event_buffer, '\n');
-        if (oldest_event) {
-            int shift_amount = (oldest_event - event_buffer) + 1; 
-            memmove(event_buffer, oldest_event + 1, BUFFER_SIZE - shift_amount);
-            buffer_pos -= shift_amount;
-        } else {
-            // If no newline is found, just clear buffer
-            buffer_pos = 0;
+// Same for a device disabled through sysfs - it stays connected, but stops sending releases
+static void state_drop_buttons(u16 id) {
+    struct mouse_device_state *st = &mouse_state->dev[id];
+
+    preempt_disable();
+    state_write_begin(st);
+    WRITE_ONCE(st->buttons, 0);
+    state_write_end(st);
+    preempt_enable();
+
+    state_update_all_buttons();
+}
+
+static void state_add(struct mouse_device_state *st, const struct mouse_event_record *rec) {
+    state_write_begin(st);
+    st->x += rec->rel_x;
+    st->y += rec->rel_y;
+    st->wheel += rec->wheel;
+    st->hwheel += rec->hwheel;
+    st->frames++;
+    st->timestamp_ns = rec->timestamp_ns;
+    WRITE_ONCE(st->buttons, rec->buttons); // other devices read it for entry 0
+    state_write_end(st);
+}
+
+// Folds a frame into its device's entry (no lock, this device is the only writer) and the
+// all devices entry (state_all_lock) - O(1) unless buttons changed
+static void state_frame(const struct mouse_event_record *rec) {
+    struct mouse_device_state *all = &mouse_state->dev[0];
+    struct mouse_event_record sum = *rec;
+    unsigned long flags;
+
+    state_add(&mouse_state->dev[rec->device_id], rec);
+
+    spin_lock_irqsave(&state_all_lock, flags);
+    if (rec->pressed || rec->released) {
+        // held on any device - another device changing its buttons right now takes the lock
+        // after its own entry is written, so whoever comes last leaves the right value
+        sum.buttons = state_held_buttons();
+    } else {
+        sum.buttons = all->buttons;
+    }
+    state_add(all, &sum);
+    spin_unlock_irqrestore(&state_all_lock, flags);
+}
+
+// Copy of the page for MOUSE_LOGGER_GET_STATE, every entry consistent on its own - the same
+// seq retry user space does on the mapped page
+static void state_copy(struct mouse_state_page *copy) {
+    int i;
+
+    copy->version = mouse_state->version;
+    copy->count = mouse_state->count;
+    for (i = 0; i < MOUSE_STATE_DEVICES; i++) {
+        const struct mouse_device_state *st = &mouse_state->dev[i];
+        u32 seq;
+
+        for (;;) {
+            seq = READ_ONCE(st->seq);
+            smp_rmb();
+            copy->dev[i] = *st;
+            smp_rmb();
+            if (!(seq & 1) && READ_ONCE(st->seq) == seq) break;
+            cpu_relax(); // a writer is in the middle of this entry
         }
     }
+}
+
+// Points a reader at the current ring if it was resized since the reader last looked
+static void reader_sync(struct mouse_reader *reader, struct mouse_ring *ring) {
+    if (reader->generation == ring->generation) return;
+
+    reader->generation = ring->generation;
+    reader->cursor = max(READ_ONCE(ring->hdr->data_tail), ring_oldest(ring));
+}
+
+static bool is_frame(const struct mouse_event_record *rec) {
+    return rec->type == EV_SYN && rec->code == SYN_REPORT;
+}
+
+// Strips the parts of a frame this reader didn't ask for - false if nothing wanted is left
+static bool reader_filter(struct mouse_reader *reader, struct mouse_event_record *rec) {
+    const struct mouse_filter *f = &reader->filter;
+    u16 buttons = f->button_mask ? f->button_mask : U16_MAX;
+
+    if (!is_frame(rec)) return true;
+    if (f->device_mask && (rec->device_id >= 64 || !(f->device_mask & BIT_ULL(rec->device_id)))) return false;
+
+    rec->pressed = (f->kinds & MOUSE_FILTER_PRESS) ? rec->pressed & buttons : 0;
+    rec->released = (f->kinds & MOUSE_FILTER_RELEASE) ? rec->released & buttons : 0;
+    if (!(f->kinds & MOUSE_FILTER_MOTION)) rec->rel_x = rec->rel_y = 0;
+    if (!(f->kinds & MOUSE_FILTER_WHEEL)) rec->wheel = rec->hwheel = 0;
+
+    return rec->pressed || rec->released || rec->rel_x || rec->rel_y || rec->wheel || rec->hwheel;
+}
+
+// Motion-only frames smaller than min_motion are dropped
+static bool reader_motion_ok(struct mouse_reader *reader, const struct mouse_event_record *rec) {
+    if (!is_frame(rec) || rec->pressed || rec->released || rec->wheel || rec->hwheel) return true;
+    return abs(rec->rel_x) + abs(rec->rel_y) >= reader->filter.min_motion;
+}
+
+// Queues a record for reader_peek() to return
+static void reader_set_next(struct mouse_reader *reader, const struct mouse_event_record *rec) {
+    if (!reader_motion_ok(reader, rec)) {
+        stat_inc(filtered);
+        return;
+    }
+    reader->next = *rec;
+    reader->has_next = true;
+}
+
+// Hands out the accumulated frames as one record and starts over
+static void reader_flush_acc(struct mouse_reader *reader) {
+    reader_set_next(reader, &reader->acc);
+    reader->acc_frames = 0;
+    reader->acc_flush = false;
+}
+
+// Adds a filtered frame to the accumulator, flushing it every filter.accumulate frames
+// or as soon as a button changes, so clicks are never delayed behind motion.
+// reader_peek() also flushes a partial sum once the ring is drained.
+static void reader_accumulate(struct mouse_reader *reader, const struct mouse_event_record *rec) {
+    struct mouse_event_record *acc = &reader->acc;
+
+    if (!reader->acc_frames) {
+        *acc = *rec;
+    } else {
+        acc->timestamp_ns = rec->timestamp_ns;
+        acc->buttons = rec->buttons;
+        acc->pressed |= rec->pressed;
+        acc->released |= rec->released;
+        acc->rel_x += rec->rel_x;
+        acc->rel_y += rec->rel_y;
+        acc->wheel += rec->wheel;
+        acc->hwheel += rec->hwheel;
+    }
+    if (++reader->acc_frames >= reader->filter.accumulate || acc->pressed || acc->released) reader_flush_acc(reader);
+}
+
+// Fetches the next record for a reader without consuming it.
+// A reader that was lapped first gets an EV_SYN/SYN_DROPPED record saying how many events it lost.
+// Records the reader's filter rejects are skipped here, so they never cost a copy to user space.
+static bool reader_peek(struct mouse_reader *reader, struct mouse_ring *ring, struct mouse_event_record *rec) {
+    u64 skipped;
 
-    // Log new event
-    buffer_pos += snprintf(event_buffer + buffer_pos, BUFFER_SIZE - buffer_pos, "%s\n", event);
-    data_available = 1; 
+    while (1) {
+        if (reader->has_next) {
+            *rec = reader->next;
+            return true;
+        }
+        if (reader->acc_frames && reader->acc_flush) {
+            reader_flush_acc(reader);
+            continue;
+        }
+        if (reader->lost) {
+            ring_lost_record(rec, reader->lost, ktime_get_ns());
+            reader->lost = 0;
+            reader_set_next(reader, rec);
+            continue;
+        }
 
-    // Wakes up waiting read process
-    wake_up_interruptible(&mouse_wait_queue); 
+        switch (ring_fetch(ring, reader->cursor, rec)) {
+            case RING_OK:
+                if (!reader_filter(reader, rec)) {
+                    stat_inc(filtered);
+                    reader->cursor++;
+                } else if (reader->filter.accumulate > 1 && is_frame(rec)) {
+                    // frames from different devices are never summed together
+                    if (reader->acc_frames && reader->acc.device_id != rec->device_id) {
+                        reader_flush_acc(reader);
+                        continue;
+                    }
+                    reader->cursor++;
+                    reader_accumulate(reader, rec);
+                } else {
+                    reader->cursor++;
+                    reader_set_next(reader, rec);
+                }
+                break;
+            case RING_EMPTY:
+                // nothing more to add right now - a partial sum goes out with this read instead
+                // of waiting for motion that may never come (a dead stream returns it before EOF)
+                if (reader->acc_frames) {
+                    reader_flush_acc(reader);
+                    continue;
+                }
+                return false;
+            default:
+                // Reader fell a whole ring behind - skip to the oldest record still stored
+                skipped = ring_skip_lapped(ring, &reader->cursor);
+                reader->lost += skipped;
+                atomic64_add(skipped, &reader->stream->dropped);
+                stat_add(dropped, skipped);
+        }
+    }
+}
 
-    mutex_unlock(&buffer_lock); 
+// Moves past the record reader_peek() returned
+static void reader_consume(struct mouse_reader *reader) {
+    reader->has_next = false;
 }
 
-// Function to clear the event buffer
-static void clear_buffer(void) {
-    mutex_lock(&buffer_lock);
-    buffer_pos = 0; // Reset buffer position
-    data_available = 0; 
-    mutex_unlock(&buffer_lock);
+// Function to clear the event buffer - this reader and readers opened later skip everything so far
+static int clear_buffer(struct mouse_reader *reader) {
+    struct mouse_stream *stream = reader->stream;
+    struct mouse_ring *ring;
+    u64 head;
+
+    if (mutex_lock_interruptible(&reader->lock)) return -ERESTARTSYS;
+    down_read(&stream->sem);
+    ring = rcu_dereference_protected(stream->ring, lockdep_is_held(&stream->sem));
+    reader_sync(reader, ring);
+    head = atomic64_read(ring->head);
+    WRITE_ONCE(ring->hdr->data_tail, head);
+    reader->cursor = head;
+    reader->lost = 0;
+    reader->has_next = false;
+    reader->acc_frames = 0;
+    reader->acc_flush = false;
+    up_read(&stream->sem);
+    mutex_unlock(&reader->lock);
     printk(KERN_INFO "Mouse Logger: Buffer cleared\n");
+    return 0;
+}
+
+// Asks producers to wake the wait queue once position pos is published
+static void wake_arm(struct mouse_stream *stream, u64 pos) {
+    s64 cur = atomic64_read(&stream->wake_pos);
+
+    while ((s64)pos < cur && !atomic64_try_cmpxchg(&stream->wake_pos, &cur, pos))
+        ;
+    smp_mb(); // pairs with the barrier in log_event()
 }
 
-// used by userspace to read from device file (defined in fops)
-static ssize_t proc_read(struct file *file, char __user *user_buffer, size_t len, loff_t *offset) {
-    mutex_lock(&buffer_lock);
+// Arms a wakeup for pos, then checks it - must run after the caller is on the wait queue
+static bool ring_ready_or_arm(struct mouse_stream *stream, struct mouse_ring *ring, u64 pos) {
+    if (ring_ready(ring, pos)) return true;
+    wake_arm(stream, pos);
+    return ring_ready(ring, pos);
+}
+
+// Wait condition for reads and poll: true once watermark events are pending, or
+// timeout_us has passed since the first unread one. Arms wake_pos / the timer otherwise.
+static bool reader_wakeup_due(struct mouse_reader *reader) {
+    struct mouse_stream *stream = reader->stream;
+    struct mouse_event_record first;
+    struct mouse_ring *ring;
+    u64 cursor = READ_ONCE(reader->cursor);
+    u64 expires;
+    bool ret = true;
+
+    rcu_read_lock();
+    ring = rcu_dereference(stream->ring);
+    if (reader->has_next || reader->lost || reader->generation != ring->generation) goto out;
+    if (READ_ONCE(stream->dead)) goto out;
 
-    while (buffer_pos == 0) {
-        // mutex unlocks if there is no data, locks again when process wakes up
-        mutex_unlock(&buffer_lock);
-        if (wait_event_interruptible(mouse_wait_queue, data_available)) return -ERESTARTSYS; // Handle interruption
-        mutex_lock(&buffer_lock);
+    // nothing pending yet - wake on the first event (it starts the timeout, if there is one)
+    if (!ring_ready_or_arm(stream, ring, cursor)) {
+        ret = false;
+        goto out;
     }
+    if (reader->watermark <= 1 || READ_ONCE(reader->timer_expired)) goto out;
 
-    // Copy event data to user space
-    size_t bytes_to_copy = min(len, (size_t)buffer_pos);
-    if (copy_to_user(user_buffer, event_buffer, bytes_to_copy)) {
-        mutex_unlock(&buffer_lock);
-        return -EFAULT;
+    if (reader->timeout_us && !hrtimer_active(&reader->timer)) {
+        expires = ring_fetch(ring, cursor, &first) == RING_OK ? first.timestamp_ns : ktime_get_ns();
+        expires += (u64)reader->timeout_us * NSEC_PER_USEC;
+        hrtimer_start(&reader->timer, ns_to_ktime(expires), HRTIMER_MODE_ABS);
     }
+    ret = ring_ready_or_arm(stream, ring, cursor + reader->watermark - 1);
+out:
+    rcu_read_unlock();
+    return ret;
+}
+
+static enum hrtimer_restart reader_timer_fn(struct hrtimer *timer) {
+    struct mouse_reader *reader = container_of(timer, struct mouse_reader, timer);
+
+    WRITE_ONCE(reader->timer_expired, true);
+    wake_up_interruptible(&reader->stream->wait);
+    return HRTIMER_NORESTART;
+}
 
-    buffer_pos = 0;
-    data_available = 0;
-    *offset += bytes_to_copy;
+// Used by MOUSE_LOGGER_WAIT - mmap consumers sleep here once they have caught up with the ring
+static bool position_ready(struct mouse_stream *stream, u64 pos) {
+    bool ret;
 
-    mutex_unlock(&buffer_lock);
-    return bytes_to_copy;
+    rcu_read_lock();
+    ret = ring_ready_or_arm(stream, rcu_dereference(stream->ring), pos) || READ_ONCE(stream->dead);
+    rcu_read_unlock();
+    return ret;
 }
 
-// Proc file operations - only read is used (input device)
+// used by userspace to read from the device files
+// Only whole records / whole lines are copied, the rest stays queued for this reader's next read.
+// Records are rendered into reader->batch under stream->sem and copied out after dropping it:
+// copy_to_user() can fault and take mmap_lock, which mouse_mmap() holds while taking sem.
+static ssize_t mouse_read(struct file *file, char __user *user_buffer, size_t len, loff_t *offset) {
+    struct mouse_reader *reader = file->private_data;
+    struct mouse_stream *stream = reader->stream;
+    size_t copied = 0;
+    char line[256];
+    struct mouse_event_record rec;
+    struct reader_pos saved;
+    struct mouse_ring *ring;
+    unsigned int records, stamps, i;
+    u64 now;
+
+    if (mutex_lock_interruptible(&reader->lock)) return -ERESTARTSYS;
+
+    while (1) {
+        size_t limit = min_t(size_t, len - copied, READ_BATCH_SIZE);
+        size_t filled = 0;
+        bool full = false;
+
+        if (!copied && !reader_wakeup_due(reader)) {
+            // not enough pending for this reader's watermark yet - same answer poll() gives
+            if (file->f_flags & O_NONBLOCK) {
+                mutex_unlock(&reader->lock);
+                return -EAGAIN;
+            }
+
+            // process sleeps until there is enough for this reader - without reader->lock, so
+            // ioctls on this file don't hang behind it and the new settings apply to this wait
+            mutex_unlock(&reader->lock);
+            if (wait_event_interruptible(stream->wait, reader_wakeup_due(reader)))
+                return -ERESTARTSYS; // Handle interruption
+            if (mutex_lock_interruptible(&reader->lock)) return -ERESTARTSYS;
+            continue; // settings may have changed while unlocked, check again
+        }
+
+        reader_save(reader, &saved);
+        records = 0;
+        stamps = 0;
+        down_read(&stream->sem);
+        ring = rcu_dereference_protected(stream->ring, lockdep_is_held(&stream->sem));
+        reader_sync(reader, ring);
+        while (reader_peek(reader, ring, &rec)) {
+            struct compact_state compact;
+            const void *src = &rec;
+            size_t n = sizeof(rec);
+
+            if (reader->format == MOUSE_FMT_TEXT) {
+                n = render_text(&rec, line, sizeof(line));
+                src = line;
+            } else if (reader->format == MOUSE_FMT_COMPACT) {
+                compact = reader->compact; // only kept once the record fits
+                n = compact_encode(&compact, &rec, (u8 *)line);
+                src = line;
+            }
+            // with timing on a batch also ends once it can't note any more frame timestamps
+            if (filled + n > limit ||
+                (static_branch_unlikely(&mouse_timing) && is_frame(&rec) && stamps == READ_BATCH_STAMPS)) {
+                full = true;
+                break;
+            }
+            memcpy(reader->batch + filled, src, n);
+            if (reader->format == MOUSE_FMT_COMPACT) reader->compact = compact;
+            filled += n;
+            records++;
+            reader_consume(reader);
+            if (static_branch_unlikely(&mouse_timing) && is_frame(&rec) && stamps < READ_BATCH_STAMPS)
+                reader->stamps[stamps++] = rec.timestamp_ns;
+        }
+        if (filled) trace_mouse_drain(stream->minor, records, filled, atomic64_read(ring->head) - reader->cursor);
+        up_read(&stream->sem);
+
+        // Copy event data to user space
+        if (filled && copy_to_user(user_buffer + copied, reader->batch, filled)) {
+            reader_restore(reader, &saved);
+            if (copied) break;
+            mutex_unlock(&reader->lock);
+            return -EFAULT;
+        }
+        copied += filled;
+
+        // latency is event to copied out, so the clock is read after the copy - every frame
+        // in the batch was published before it (clamped anyway, a stamp must never wrap)
+        if (stamps) {
+            now = ktime_get_ns();
+            for (i = 0; i < stamps; i++)
+                stat_hist(latency_hist, now > reader->stamps[i] ? now - reader->stamps[i] : 0);
+        }
+
+        if (full) {
+            // Buffer too small for even one record
+            if (!copied) {
+                mutex_unlock(&reader->lock);
+                return -EINVAL;
+            }
+            if (filled && copied < len) continue; // only the batch was full, the user buffer has room
+            break;
+        }
+        if (copied) break;
+        // Device is gone and everything it logged has been read - end of file
+        if (READ_ONCE(stream->dead)) break;
+    }
+
+    // the batch was delivered, the next timeout starts from the next unread event
+    hrtimer_try_to_cancel(&reader->timer);
+    WRITE_ONCE(reader->timer_expired, false);
+    mutex_unlock(&reader->lock);
+
+    if (copied) {
+        stat_inc(reads);
+        stat_add(bytes_copied, copied);
+    }
+    *offset += copied;
+    return copied;
+}
+
+// New readers start at the last clear, or the oldest record still stored.
+// Takes over the caller's reference on stream.
+static int reader_open(struct file *file, struct mouse_stream *stream) {
+    struct mouse_reader *reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+    struct mouse_ring *ring;
+
+    if (!reader) {
+        stream_put(stream);
+        return -ENOMEM;
+    }
+
+    reader->batch = kmalloc(READ_BATCH_SIZE, GFP_KERNEL);
+    if (!reader->batch) {
+        kfree(reader);
+        stream_put(stream);
+        return -ENOMEM;
+    }
+
+    mutex_init(&reader->lock);
+    reader->stream = stream;
+    reader->format = MOUSE_FMT_TEXT;
+    reader->watermark = 1;
+    reader->filter.kinds = MOUSE_FILTER_ALL;
+    hrtimer_setup(&reader->timer, reader_timer_fn, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+
+    down_read(&stream->sem);
+    ring = rcu_dereference_protected(stream->ring, lockdep_is_held(&stream->sem));
+    reader->generation = ring->generation - 1; // forces reader_sync() to place the cursor
+    reader_sync(reader, ring);
+    up_read(&stream->sem);
+
+    file->private_data = reader;
+    return 0;
+}
+
+// The minor picks the stream - 0 is the merged view, the rest belong to one device each
+static int mouse_open(struct inode *inode, struct file *file) {
+    struct mouse_stream *stream;
+
+    mutex_lock(&mouse_devs_lock);
+    stream = mouse_streams[iminor(inode)];
+    if (stream) kref_get(&stream->ref);
+    mutex_unlock(&mouse_devs_lock);
+
+    if (!stream) return -ENODEV; // device disconnected between lookup and open
+    return reader_open(file, stream);
+}
+
+// Readable as soon as this reader's cursor has something, so epoll can multiplex logger devices
+static __poll_t mouse_poll(struct file *file, poll_table *wait) {
+    struct mouse_reader *reader = file->private_data;
+
+    __poll_t mask = 0;
+
+    poll_wait(file, &reader->stream->wait, wait);
+    if (READ_ONCE(reader->stream->dead)) mask |= EPOLLHUP; // device unplugged
+    if (reader_wakeup_due(reader)) mask |= EPOLLIN | EPOLLRDNORM;
+    return mask;
+}
+
+// Adds or removes this file from the SIGIO list (fcntl O_ASYNC)
+static int mouse_fasync_setup(int fd, struct file *file, int on) {
+    struct mouse_reader *reader = file->private_data;
+
+    return fasync_helper(fd, file, on, &reader->stream->fasync);
+}
+
+static int mouse_release(struct inode *inode, struct file *file) {
+    struct mouse_reader *reader = file->private_data;
+
+    mouse_fasync_setup(-1, file, 0);
+    hrtimer_cancel(&reader->timer);
+    stream_put(reader->stream);
+    kfree(reader->batch);
+    kfree(reader);
+    return 0;
+}
+
+// /proc/mouse_events is a snapshot of the merged ring, rendered by seq_file only as it is read.
+// Opening it notes which positions exist; reading pages through them without touching any
+// reader's cursor, so the input path never pays for text and other consumers see no difference.
+struct proc_snapshot {
+    u64 first; // position shown at index 0 - the last clear, or the oldest record still stored
+    u64 head; // end of the snapshot
+    u32 generation; // a resize while paging ends the snapshot
+    struct mouse_ring *ring; // only valid between start and stop
+    struct mouse_event_record rec; // record being shown
+    char line[256];
+};
+
+static void *events_seq_fetch(struct seq_file *m, loff_t *index) {
+    struct proc_snapshot *snap = m->private;
+    u64 pos = snap->first + *index;
+    u64 oldest;
+
+    if (pos >= snap->head) return NULL;
+
+    switch (ring_fetch(snap->ring, pos, &snap->rec)) {
+        case RING_OK:
+            return snap;
+        case RING_LAPPED:
+            // overwritten while paging - show the gap once, the next index is the oldest left
+            oldest = min(ring_oldest(snap->ring), snap->head);
+            ring_lost_record(&snap->rec, oldest - pos, 0);
+            snap->first = oldest - (*index + 1);
+            return snap;
+        default:
+            return NULL; // claimed by a producer that hasn't finished writing it
+    }
+}
+
+static void *events_seq_start(struct seq_file *m, loff_t *index) {
+    struct proc_snapshot *snap = m->private;
+
+    down_read(&merged_stream->sem); // released in events_seq_stop(), before copying to the user
+    snap->ring = rcu_dereference_protected(merged_stream->ring, lockdep_is_held(&merged_stream->sem));
+    if (snap->ring->generation != snap->generation) return NULL;
+    return events_seq_fetch(m, index);
+}
+
+static void *events_seq_next(struct seq_file *m, void *v, loff_t *index) {
+    ++*index;
+    return events_seq_fetch(m, index);
+}
+
+static void events_seq_stop(struct seq_file *m, void *v) {
+    up_read(&merged_stream->sem);
+}
+
+static int events_seq_show(struct seq_file *m, void *v) {
+    struct proc_snapshot *snap = v;
+
+    seq_write(m, snap->line, render_text(&snap->rec, snap->line, sizeof(snap->line)));
+    return 0;
+}
+
+static const struct seq_operations events_seq_ops = {
+    .start = events_seq_start,
+    .next = events_seq_next,
+    .stop = events_seq_stop,
+    .show = events_seq_show,
+};
+
+static int events_proc_open(struct inode *inode, struct file *file) {
+    struct proc_snapshot *snap = __seq_open_private(file, &events_seq_ops, sizeof(*snap));
+    struct mouse_ring *ring;
+
+    if (!snap) return -ENOMEM;
+
+    down_read(&merged_stream->sem);
+    ring = rcu_dereference_protected(merged_stream->ring, lockdep_is_held(&merged_stream->sem));
+    snap->generation = ring->generation;
+    snap->head = atomic64_read(ring->head);
+    snap->first = min(max(READ_ONCE(ring->hdr->data_tail), ring_oldest(ring)), snap->head);
+    up_read(&merged_stream->sem);
+    return 0;
+}
+
+// Proc file operations - seq_file does the paging, so large rings can be read in any buffer size
 static const struct proc_ops proc_fops = {
-    .proc_read = proc_read,
+    .proc_open = events_proc_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = seq_release_private,
+};
+
+// The mapping keeps its stream alive and pinned to the current ring
+static void ring_vma_open(struct vm_area_struct *vma) {
+    struct mouse_stream *stream = vma->vm_private_data;
+
+    kref_get(&stream->ref);
+    atomic_inc(&stream->mmaps);
+}
+
+static void ring_vma_close(struct vm_area_struct *vma) {
+    struct mouse_stream *stream = vma->vm_private_data;
+
+    atomic_dec(&stream->mmaps);
+    stream_put(stream);
+}
+
+static const struct vm_operations_struct ring_vm_ops = {
+    .open = ring_vma_open,
+    .close = ring_vma_close,
 };
 
-// ioctl command to clear the buffer
+// Maps the ring header page and slots read-only, perf ring buffer style
+static int mouse_mmap(struct file *file, struct vm_area_struct *vma) {
+    struct mouse_reader *reader = file->private_data;
+    struct mouse_stream *stream = reader->stream;
+    struct mouse_ring *ring;
+    int ret;
+
+    if (vma->vm_flags & VM_WRITE) return -EPERM; // other consumers rely on the slots, so no writers
+
+    // the state page, shared by every node - it lives until the module is unloaded
+    if (vma->vm_pgoff == MOUSE_STATE_PGOFF) {
+        if (vma->vm_end - vma->vm_start > PAGE_SIZE) return -EINVAL;
+        vm_flags_clear(vma, VM_MAYWRITE);
+        return remap_vmalloc_range(vma, mouse_state, 0);
+    }
+    if (vma->vm_pgoff) return -EINVAL;
+
+    down_read(&stream->sem);
+    ring = rcu_dereference_protected(stream->ring, lockdep_is_held(&stream->sem));
+    if (vma->vm_end - vma->vm_start > ring->size) {
+        up_read(&stream->sem);
+        return -EINVAL;
+    }
+
+    vm_flags_clear(vma, VM_MAYWRITE);
+    ret = remap_vmalloc_range(vma, ring->hdr, 0);
+    if (!ret) {
+        vma->vm_ops = &ring_vm_ops;
+        vma->vm_private_data = stream;
+        ring_vma_open(vma);
+    }
+    up_read(&stream->sem);
+    return ret;
+}
+
+static void get_ring_info(struct mouse_stream *stream, struct mouse_ring_info *info) {
+    struct mouse_ring *ring;
+
+    rcu_read_lock();
+    ring = rcu_dereference(stream->ring);
+    info->capacity = ring->capacity;
+    info->head = atomic64_read(ring->head);
+    rcu_read_unlock();
+
+    info->record_size = sizeof(struct mouse_event_record);
+    info->dropped = atomic64_read(&stream->dropped);
+}
+
+// Sums the per CPU counters - only runs when someone asks, so it can take its time
+static void get_stats(struct mouse_stats *stats) {
+    int cpu, i;
+
+    memset(stats, 0, sizeof(*stats));
+    for_each_possible_cpu(cpu) {
+        const struct mouse_cpu_stats *c = per_cpu_ptr(&mouse_cpu_stats, cpu);
+
+        stats->events += c->events;
+        stats->frames += c->frames;
+        stats->filtered += c->filtered;
+        stats->dropped += c->dropped;
+        stats->reads += c->reads;
+        stats->bytes_copied += c->bytes_copied;
+        stats->wakeups += c->wakeups;
+        stats->handler_ns += c->handler_ns;
+        stats->log_ns += c->log_ns;
+        for (i = 0; i < MOUSE_STATS_BUCKETS; i++) {
+            stats->log_hist[i] += c->log_hist[i];
+            stats->latency_hist[i] += c->latency_hist[i];
+        }
+    }
+    stats->timing = static_key_enabled(&mouse_timing);
+}
+
+// Prints the non-empty buckets of a histogram as "  <from>-<to> ns: count" lines
+static void show_hist(struct seq_file *m, const char *title, const u64 *hist) {
+    int i;
+
+    seq_printf(m, "%s:\n", title);
+    for (i = 0; i < MOUSE_STATS_BUCKETS; i++) {
+        if (hist[i]) seq_printf(m, "  %llu-%llu ns: %llu\n", i ? BIT_ULL(i) : 0, BIT_ULL(i + 1) - 1, hist[i]);
+    }
+}
+
+// /proc/mouse_stats - the same numbers as MOUSE_LOGGER_GET_STATS, for people without a tool
+static int stats_proc_show(struct seq_file *m, void *v) {
+    struct mouse_stats *stats = kmalloc(sizeof(*stats), GFP_KERNEL); // too big for the stack
+
+    if (!stats) return -ENOMEM;
+    get_stats(stats);
+
+    seq_printf(m, "events %llu\n", stats->events);
+    seq_printf(m, "frames %llu\n", stats->frames);
+    seq_printf(m, "filtered %llu\n", stats->filtered);
+    seq_printf(m, "dropped %llu\n", stats->dropped);
+    seq_printf(m, "reads %llu\n", stats->reads);
+    seq_printf(m, "bytes_copied %llu\n", stats->bytes_copied);
+    seq_printf(m, "wakeups %llu\n", stats->wakeups);
+    seq_printf(m, "timing %llu\n", stats->timing);
+    seq_printf(m, "handler_ns %llu\n", stats->handler_ns);
+    seq_printf(m, "log_ns %llu\n", stats->log_ns);
+    show_hist(m, "log_event", stats->log_hist);
+    show_hist(m, "latency", stats->latency_hist);
+
+    kfree(stats);
+    return 0;
+}
+
+// ioctl commands to clear the buffer, pick the read format and size the ring
 static long mouse_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    struct mouse_reader *reader = file->private_data;
+    struct mouse_stream *stream = reader->stream;
+    int version = MOUSE_LOGGER_ABI_VERSION;
+    struct mouse_ring_info info;
+    struct mouse_wakeup_config wakeup;
+    struct mouse_filter filter;
+    struct mouse_stats *stats;
+    struct mouse_state_page *state;
+    u32 capacity;
+    u64 pos;
+    int format;
+    int ret;
+
     switch (cmd) {
         case MOUSE_LOGGER_CLEAR:
-            clear_buffer();
+            return clear_buffer(reader);
+        case MOUSE_LOGGER_SET_FORMAT:
+            if (get_user(format, (int __user *)arg)) return -EFAULT;
+            if (format != MOUSE_FMT_TEXT && format != MOUSE_FMT_BINARY && format != MOUSE_FMT_COMPACT) return -EINVAL;
+            if (mutex_lock_interruptible(&reader->lock)) return -ERESTARTSYS;
+            reader->format = format;
+            memset(&reader->compact, 0, sizeof(reader->compact)); // deltas restart
+            mutex_unlock(&reader->lock);
+            return 0;
+        case MOUSE_LOGGER_GET_VERSION:
+            if (copy_to_user((int __user *)arg, &version, sizeof(version))) return -EFAULT;
+            return 0;
+        case MOUSE_LOGGER_SET_CAPACITY:
+            if (get_user(capacity, (u32 __user *)arg)) return -EFAULT;
+            if (capacity < RING_MIN_CAPACITY || capacity > RING_MAX_CAPACITY) return -EINVAL;
+            return ring_resize(stream, capacity);
+        case MOUSE_LOGGER_GET_RING_INFO:
+            get_ring_info(stream, &info);
+            if (copy_to_user((struct mouse_ring_info __user *)arg, &info, sizeof(info))) return -EFAULT;
+            return 0;
+        case MOUSE_LOGGER_SET_WAKEUP:
+            if (copy_from_user(&wakeup, (struct mouse_wakeup_config __user *)arg, sizeof(wakeup))) return -EFAULT;
+            if (wakeup.watermark > RING_MAX_CAPACITY) return -EINVAL;
+            if (mutex_lock_interruptible(&reader->lock)) return -ERESTARTSYS;
+            reader->watermark = max(wakeup.watermark, 1u);
+            reader->timeout_us = wakeup.timeout_us;
+            hrtimer_cancel(&reader->timer);
+            WRITE_ONCE(reader->timer_expired, false);
+            mutex_unlock(&reader->lock);
+            wake_up_interruptible(&stream->wait); // waiters re-evaluate with the new settings
             return 0;
+        case MOUSE_LOGGER_SET_FILTER:
+            if (copy_from_user(&filter, (struct mouse_filter __user *)arg, sizeof(filter))) return -EFAULT;
+            if (filter.kinds & ~MOUSE_FILTER_ALL) return -EINVAL;
+            if (mutex_lock_interruptible(&reader->lock)) return -ERESTARTSYS;
+            reader->filter = filter;
+            reader->acc_flush = reader->acc_frames > 0; // frames summed so far still go out, as one record
+            mutex_unlock(&reader->lock);
+            return 0;
+        case MOUSE_LOGGER_WAIT:
+            if (get_user(pos, (u64 __user *)arg)) return -EFAULT;
+            if ((file->f_flags & O_NONBLOCK) && !position_ready(stream, pos)) return -EAGAIN;
+            if (wait_event_interruptible(stream->wait, position_ready(stream, pos))) return -ERESTARTSYS;
+            return 0;
+        case MOUSE_LOGGER_GET_STATS:
+            stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+            if (!stats) return -ENOMEM;
+            get_stats(stats);
+            ret = copy_to_user((struct mouse_stats __user *)arg, stats, sizeof(*stats)) ? -EFAULT : 0;
+            kfree(stats);
+            return ret;
+        case MOUSE_LOGGER_GET_STATE:
+            state = kmalloc(sizeof(*state), GFP_KERNEL);
+            if (!state) return -ENOMEM;
+            state_copy(state);
+            ret = copy_to_user((struct mouse_state_page __user *)arg, state, sizeof(*state)) ? -EFAULT : 0;
+            kfree(state);
+            return ret;
         default:
             return -ENOTTY; // Unknown command
     }
 }
 
-// User space commands (read and ioctl)
+// User space commands (open, read, poll, mmap and ioctl)
 static struct file_operations fops = {
     .owner = THIS_MODULE,
-    .read = proc_read, // Use proc_read function for device reads
+    .open = mouse_open,
+    .release = mouse_release,
+    .read = mouse_read,
+    .poll = mouse_poll,
+    .fasync = mouse_fasync_setup,
+    .mmap = mouse_mmap,
     .unlocked_ioctl = mouse_ioctl,
 };
 
-// Callback function to handle mouse events
-static void mouse_event(struct input_handle *handle, unsigned int type, unsigned int code, int value) {
-    char event[64];
-    if (type == EV_KEY && value) {
-        if (code == BTN_LEFT) log_event("Left Click");
-        else if (code == BTN_RIGHT) log_event("Right Click");
-        else if (code == BTN_MIDDLE) log_event("Middle Click");
-    } else if (type == EV_REL) {
-        if (code == REL_X) {
-            snprintf(event, sizeof(event), "Mouse Move: X=%d", value);
-            log_event(event);
-        } else if (code == REL_Y) {
-            snprintf(event, sizeof(event), "Mouse Move: Y=%d", value);
-            log_event(event);
+// Logs the collected frame to the device's own stream and the merged one, then starts a new
+// frame - buttons held carry over
+static void mouse_emit_frame(struct mouse_dev *mdev) {
+    struct mouse_event_record *frame = &mdev->frame;
+
+    frame->timestamp_ns = ktime_get_ns();
+    log_event(mdev->stream, frame);
+    log_event(merged_stream, frame);
+    state_frame(frame);
+    stat_inc(frames);
+
+    frame->pressed = 0;
+    frame->released = 0;
+    frame->rel_x = 0;
+    frame->rel_y = 0;
+    frame->wheel = 0;
+    frame->hwheel = 0;
+    mdev->frame_dirty = false;
+}
+
+// Callback function to handle mouse events - gets a whole batch of values (normally one frame
+// ending in SYN_REPORT) and folds them into one record per frame, no formatting
+static unsigned int mouse_events(struct input_handle *handle, struct input_value *vals, unsigned int count) {
+    struct mouse_dev *mdev = container_of(handle, struct mouse_dev, handle);
+    struct mouse_event_record *frame = &mdev->frame;
+    unsigned int i;
+    u64 start = 0;
+    u16 bit;
+
+    if (static_branch_unlikely(&mouse_timing)) start = ktime_get_ns();
+    stat_add(events, count);
+
+    for (i = 0; i < count; i++) {
+        const struct input_value *v = &vals[i];
+
+        trace_mouse_receive(mdev->id, v->type, v->code, v->value);
+
+        switch (v->type) {
+            case EV_REL:
+                if (v->code == REL_X) frame->rel_x += v->value;
+                else if (v->code == REL_Y) frame->rel_y += v->value;
+                else if (v->code == REL_WHEEL) frame->wheel += v->value;
+                else if (v->code == REL_HWHEEL) frame->hwheel += v->value;
+                else break;
+                mdev->frame_dirty = true;
+                break;
+            case EV_KEY:
+                if (v->code < BTN_MOUSE || v->code > BTN_TASK) break;
+                bit = MOUSE_BTN(v->code);
+                if (v->value && !(frame->buttons & bit)) {
+                    frame->pressed |= bit;
+                    frame->buttons |= bit;
+                    mdev->frame_dirty = true;
+                } else if (!v->value && (frame->buttons & bit)) {
+                    frame->released |= bit;
+                    frame->buttons &= ~bit;
+                    mdev->frame_dirty = true;
+                }
+                break;
+            case EV_SYN:
+                if (v->code == SYN_REPORT && mdev->frame_dirty) mouse_emit_frame(mdev);
+                break;
         }
     }
+
+    if (static_branch_unlikely(&mouse_timing)) stat_add(handler_ns, ktime_get_ns() - start);
+    return count; // nothing is filtered out for other handlers
 }
 
 // Function to handle new mouse device connection
+// Only called for devices matching mouse_ids, so no capability checks are needed here
+// Each device gets its own stream and /dev/mouse_logger_<id + 1> node
 static int mouse_connect(struct input_handler *handler, struct input_dev *dev, const struct input_device_id *id) {
-    struct input_handle *handle;
-    if (!dev) return -ENODEV;
-    if (!test_bit(EV_KEY, dev->evbit) || !test_bit(BTN_LEFT, dev->keybit)) return -ENODEV;
+    struct mouse_dev *mdev;
+    struct device *node;
+    int dev_id;
 
-    handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
-    if (!handle) return -ENOMEM;
+    // device ids double as minors, 0 is the merged view
+    dev_id = ida_alloc_range(&mouse_ida, 1, MOUSE_MINORS - 1, GFP_KERNEL);
+    if (dev_id < 0) return dev_id;
 
-    handle->dev = dev;
-    handle->handler = handler;
-    handle->name = "mouse_logger";
-
-    if (input_register_handle(handle)) {
-        kfree(handle);
-        return -EINVAL;
+    mdev = kzalloc(sizeof(*mdev), GFP_KERNEL);
+    if (!mdev) {
+        ida_free(&mouse_ida, dev_id);
+        return -ENOMEM;
     }
-    if (input_open_device(handle)) {
-        input_unregister_handle(handle);
-        kfree(handle);
-        return -EINVAL;
+    mdev->stream = stream_create(dev_id);
+    if (!mdev->stream) {
+        kfree(mdev);
+        ida_free(&mouse_ida, dev_id);
+        return -ENOMEM;
     }
+    mdev->id = dev_id;
+    mdev->frame.device_id = dev_id;
+    mdev->frame.type = EV_SYN;
+    mdev->frame.code = SYN_REPORT;
+
+    mdev->handle.dev = dev;
+    mdev->handle.handler = handler;
+    mdev->handle.name = "mouse_logger";
+    state_set_connected(dev_id, true); // before the first event can arrive
+
+    if (input_register_handle(&mdev->handle)) goto err_free;
+    if (input_open_device(&mdev->handle)) goto err_unregister;
+    mdev->enabled = true;
+
+    // stream is in the table before the node exists, so opening the node always finds it
+    mutex_lock(&mouse_devs_lock);
+    mouse_streams[dev_id] = mdev->stream;
+    list_add_tail(&mdev->node, &mouse_devs);
+    mutex_unlock(&mouse_devs_lock);
+
+    node = device_create(mouse_class, NULL, MKDEV(major_number, dev_id), NULL, DEVICE_NAME_FMT, dev_id + 1);
+    if (IS_ERR(node)) // events still reach the merged view
+        printk(KERN_WARNING "Mouse Logger: No device node for %s (id %d)\n", dev->name, dev_id);
 
-    printk(KERN_INFO "Mouse Logger: Connected to device %s\n", dev->name);
+    printk(KERN_INFO "Mouse Logger: Connected to device %s (id %d, /dev/" DEVICE_NAME_FMT ")\n",
+           dev->name, dev_id, dev_id + 1);
     return 0;
+
+err_unregister:
+    input_unregister_handle(&mdev->handle);
+err_free:
+    state_set_connected(dev_id, false);
+    stream_put(mdev->stream);
+    ida_free(&mouse_ida, dev_id);
+    kfree(mdev);
+    return -EINVAL;
 }
 
 static void mouse_disconnect(struct input_handle *handle) {
-    input_close_device(handle);
+    struct mouse_dev *mdev = container_of(handle, struct mouse_dev, handle);
+
+    mutex_lock(&mouse_devs_lock);
+    list_del(&mdev->node);
+    mouse_streams[mdev->id] = NULL; // no new opens
+    if (mdev->enabled) input_close_device(handle);
+    mutex_unlock(&mouse_devs_lock);
+
     input_unregister_handle(handle);
-    kfree(handle);
+    device_destroy(mouse_class, MKDEV(major_number, mdev->id));
+
+    state_set_connected(mdev->id, false); // last position stays readable
+
+    // files still open keep the stream until they are closed
+    stream_kill(mdev->stream);
+    stream_put(mdev->stream);
+    ida_free(&mouse_ida, mdev->id);
+    kfree(mdev);
     printk(KERN_INFO "Mouse Logger: Device Disconnected\n");
 
 }
 
-// Input device registration
+// Opens or closes a connected device by id. A closed device stops sending events to this
+// handler altogether, so disabled devices cost nothing on the event path.
+static int mouse_set_enabled(u16 id, bool enable) {
+    struct mouse_dev *mdev;
+    int ret = -ENODEV;
+
+    mutex_lock(&mouse_devs_lock);
+    list_for_each_entry(mdev, &mouse_devs, node) {
+        if (mdev->id != id) continue;
+
+        ret = 0;
+        if (enable && !mdev->enabled) {
+            ret = input_open_device(&mdev->handle);
+            if (!ret) mdev->enabled = true;
+        } else if (!enable && mdev->enabled) {
+            input_close_device(&mdev->handle); // waits for events already being delivered
+            mdev->enabled = false;
+            // a half-collected frame is thrown away, and so are held buttons - releases sent
+            // while disabled never reach us, so the next press must not look like a repeat
+            memset(&mdev->frame, 0, sizeof(mdev->frame));
+            mdev->frame.device_id = mdev->id;
+            mdev->frame.type = EV_SYN;
+            mdev->frame.code = SYN_REPORT;
+            mdev->frame_dirty = false;
+            state_drop_buttons(mdev->id); // the state page forgets them too
+        }
+        break;
+    }
+    mutex_unlock(&mouse_devs_lock);
+    return ret;
+}
+
+// sysfs: /sys/class/mouse_logger_1/mouse_logger_1/devices lists "id enabled node name" per device
+static ssize_t devices_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct mouse_dev *mdev;
+    int len = 0;
+
+    mutex_lock(&mouse_devs_lock);
+    list_for_each_entry(mdev, &mouse_devs, node)
+        len += sysfs_emit_at(buf, len, "%u %d " DEVICE_NAME_FMT " %s\n", mdev->id, mdev->enabled,
+                             mdev->id + 1, mdev->handle.dev->name);
+    mutex_unlock(&mouse_devs_lock);
+    return len;
+}
+static DEVICE_ATTR_RO(devices);
+
+// echo <id> > enable / disable
+static ssize_t enable_disable_store(const char *buf, size_t count, bool enable) {
+    u16 id;
+    int ret;
+
+    ret = kstrtou16(buf, 0, &id);
+    if (ret) return ret;
+    ret = mouse_set_enabled(id, enable);
+    return ret ? ret : count;
+}
+
+static ssize_t enable_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    return enable_disable_store(buf, count, true);
+}
+static DEVICE_ATTR_WO(enable);
+
+static ssize_t disable_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    return enable_disable_store(buf, count, false);
+}
+static DEVICE_ATTR_WO(disable);
+
+static struct attribute *mouse_logger_attrs[] = {
+    &dev_attr_devices.attr,
+    &dev_attr_enable.attr,
+    &dev_attr_disable.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(mouse_logger);
+
+// Input device registration - only devices with relative X/Y axes and a left button,
+// i.e. mice; keyboards and absolute touchscreens never get connected
 static const struct input_device_id mouse_ids[] = {
-    { .driver_info = 1 },
+    {
+        .flags = INPUT_DEVICE_ID_MATCH_EVBIT | INPUT_DEVICE_ID_MATCH_KEYBIT | INPUT_DEVICE_ID_MATCH_RELBIT,
+        .evbit = { BIT_MASK(EV_KEY) | BIT_MASK(EV_REL) },
+        .keybit = { [BIT_WORD(BTN_LEFT)] = BIT_MASK(BTN_LEFT) },
+        .relbit = { BIT_MASK(REL_X) | BIT_MASK(REL_Y) },
+    },
     { },
 };
 
 // Defines which functions are called depending on the event
 MODULE_DEVICE_TABLE(input, mouse_ids);
 static struct input_handler mouse_handler = {
-    .event      = mouse_event,
+    .events     = mouse_events,
     .connect    = mouse_connect,
     .disconnect = mouse_disconnect,
     .name       = "mouse_logger_handler",
@@ -194,37 +1411,84 @@ static struct input_handler mouse_handler = {
 // Module initialization function
 static int __init mouse_init(void) {
     dev_t dev;
-    if (alloc_chrdev_region(&dev, 0, 1, DEVICE_NAME) < 0) return -1;
+    int ret;
+
+    BUILD_BUG_ON(sizeof(struct mouse_state_page) > PAGE_SIZE);
+    BUILD_BUG_ON(MOUSE_STATE_DEVICES != MOUSE_MINORS);
+    mouse_state = vmalloc_user(PAGE_SIZE); // zeroed, and allowed to be remapped to user space
+    if (!mouse_state) return -ENOMEM;
+    mouse_state->version = MOUSE_LOGGER_ABI_VERSION;
+    mouse_state->count = MOUSE_STATE_DEVICES;
+    mouse_state->dev[0].connected = 1;
+
+    merged_stream = stream_create(0);
+    if (!merged_stream) {
+        ret = -ENOMEM;
+        goto err_state;
+    }
+    mouse_streams[0] = merged_stream;
+
+    // one region and one cdev for the merged view and every per device minor
+    ret = alloc_chrdev_region(&dev, 0, MOUSE_MINORS, DEVICE_NAME);
+    if (ret < 0) goto err_stream;
     major_number = MAJOR(dev);
 
     cdev_init(&mouse_cdev, &fops);
-    if (cdev_add(&mouse_cdev, dev, 1) < 0) return -1;
+    ret = cdev_add(&mouse_cdev, dev, MOUSE_MINORS);
+    if (ret < 0) goto err_region;
 
     mouse_class = class_create(DEVICE_NAME);
     if (IS_ERR(mouse_class)) {
-        unregister_chrdev_region(dev, 1);
-        return PTR_ERR(mouse_class);
+        ret = PTR_ERR(mouse_class);
+        goto err_cdev;
     }
-    device_create(mouse_class, NULL, dev, NULL, DEVICE_NAME);
+    device_create_with_groups(mouse_class, NULL, dev, NULL, mouse_logger_groups, DEVICE_NAME);
 
+    ret = -ENOMEM;
     proc_file = proc_create(PROC_FILE_NAME, 0, NULL, &proc_fops);
-    if (!proc_file) return -ENOMEM;
+    if (!proc_file) goto err_class;
+    proc_stats_file = proc_create_single(PROC_STATS_NAME, 0, NULL, stats_proc_show);
+    if (!proc_stats_file) goto err_proc;
 
-    if (input_register_handler(&mouse_handler)) return -EINVAL;
+    ret = input_register_handler(&mouse_handler);
+    if (ret) goto err_proc_stats;
 
     printk(KERN_INFO "Mouse Logger Loaded. Use: cat /proc/%s\n", PROC_FILE_NAME);
     return 0;
+
+    // undo in reverse order, same as mouse_exit
+err_proc_stats:
+    proc_remove(proc_stats_file);
+err_proc:
+    proc_remove(proc_file);
+err_class:
+    device_destroy(mouse_class, dev); // fine if the node wasn't created
+    class_destroy(mouse_class);
+err_cdev:
+    cdev_del(&mouse_cdev);
+err_region:
+    unregister_chrdev_region(dev, MOUSE_MINORS);
+err_stream:
+    mouse_streams[0] = NULL;
+    stream_put(merged_stream);
+err_state:
+    vfree(mouse_state);
+    return ret;
 }
 
 // Module cleanup function
 static void __exit mouse_exit(void) {
     dev_t dev = MKDEV(major_number, 0);
-    input_unregister_handler(&mouse_handler);
+    input_unregister_handler(&mouse_handler); // disconnects every device and its node
+    proc_remove(proc_stats_file);
     proc_remove(proc_file);
     device_destroy(mouse_class, dev);
     class_destroy(mouse_class);
     cdev_del(&mouse_cdev);
-    unregister_chrdev_region(dev, 1);
+    unregister_chrdev_region(dev, MOUSE_MINORS);
+    mouse_streams[0] = NULL;
+    stream_put(merged_stream);
+    vfree(mouse_state);
     printk(KERN_INFO "Mouse Logger Unloaded.\n");
 }
 
@@ -0,0 +1,168 @@
+// Definitions shared by the mouse logger driver (mouse_driver.c) and the user space tools.
+// Bump MOUSE_LOGGER_ABI_VERSION whenever a struct or ioctl below changes layout.
+#ifndef MOUSE_LOGGER_H
+#define MOUSE_LOGGER_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define MOUSE_LOGGER_ABI_VERSION 10
+
+// Button bits used in the records below - BTN_LEFT is bit 0, up to BTN_TASK
+#define MOUSE_BTN(code)   (1u << ((code) - BTN_MOUSE))
+#define MOUSE_BTN_LEFT    MOUSE_BTN(BTN_LEFT)
+#define MOUSE_BTN_RIGHT   MOUSE_BTN(BTN_RIGHT)
+#define MOUSE_BTN_MIDDLE  MOUSE_BTN(BTN_MIDDLE)
+
+// One logged record - fixed size so readers can walk a buffer of them without parsing.
+// Normally one record per input frame (type EV_SYN, code SYN_REPORT) holding all motion and button
+// changes up to the device's SYN_REPORT, so a frame is never split across records.
+// Each open file has its own cursor; a reader that falls a whole ring behind gets one record with
+// type EV_SYN, code SYN_DROPPED and value = number of events it lost, then continues from the oldest.
+struct mouse_event_record {
+    __u64 timestamp_ns; // CLOCK_MONOTONIC time the frame reached the driver
+    __u16 device_id;    // id given to the input device when it connected
+    __u16 type;         // EV_* from linux/input-event-codes.h
+    __u16 code;         // SYN_REPORT / SYN_DROPPED
+    __u16 buttons;      // MOUSE_BTN_* bits held after the frame
+    __u16 pressed;      // MOUSE_BTN_* bits that went down in the frame
+    __u16 released;     // MOUSE_BTN_* bits that went up in the frame
+    __s32 value;        // SYN_DROPPED: number of events lost
+    __s32 rel_x;        // summed REL_X / REL_Y / REL_WHEEL / REL_HWHEEL of the frame
+    __s32 rel_y;
+    __s32 wheel;
+    __s32 hwheel;
+};
+
+// Read formats, selected per open file with MOUSE_LOGGER_SET_FORMAT
+#define MOUSE_FMT_TEXT   0 // "Left Click" / "Mouse Move: X=3 Y=-1" lines, rendered at read time (default)
+#define MOUSE_FMT_BINARY 1 // whole struct mouse_event_record entries
+#define MOUSE_FMT_COMPACT 2 // variable length records described below, for long captures
+
+// MOUSE_FMT_COMPACT: every record starts with a flags byte and the timestamp as a zigzag varint delta
+// from the previous record of this file (the first one is relative to 0), followed by only the
+// fields the flags announce, in flag order. Varints are LEB128 (7 bits per byte, low bits first);
+// signed values are zigzag encoded in 64 bits ((v << 1) ^ (v >> 63), v sign extended to 64 bits)
+// so small negatives stay short. A typical move is 7-8 bytes (the nanosecond timestamp delta takes
+// 3-4 of them) instead of 40 binary or ~20 of text. Selecting the format again restarts the deltas,
+// and a read never ends in the middle of a record.
+#define MOUSE_COMPACT_DEVICE  (1u << 0) // varint device_id, whenever it differs from the previous record
+#define MOUSE_COMPACT_MOTION  (1u << 1) // zigzag rel_x, rel_y
+#define MOUSE_COMPACT_WHEEL   (1u << 2) // zigzag wheel, hwheel
+#define MOUSE_COMPACT_BUTTONS (1u << 3) // one byte of buttons held, whenever it differs from the previous record
+#define MOUSE_COMPACT_CHANGES (1u << 4) // one byte pressed, one byte released
+#define MOUSE_COMPACT_OTHER   (1u << 5) // not a SYN_REPORT frame: varint type, varint code, zigzag value
+#define MOUSE_COMPACT_MAX     48        // longest encoding of one record
+
+// mmap() layout of the event ring: one header page, then capacity slots starting at data_offset.
+// The mapping is read-only. A record at position pos lives in slot (pos & (capacity - 1)) and is
+// valid once that slot's seq equals pos + 1; re-check seq after copying the record - if it changed,
+// producers wrapped around and overwrote it. data_head only ever grows.
+struct mouse_ring_header {
+    __u32 version;     // MOUSE_LOGGER_ABI_VERSION
+    __u32 capacity;    // number of slots, power of two
+    __u32 slot_size;   // sizeof(struct mouse_ring_slot)
+    __u32 data_offset; // bytes from the start of the mapping to slot 0
+    __u64 data_head;   // next position a producer will claim
+    __u64 data_tail;   // where newly opened readers start, moved forward by MOUSE_LOGGER_CLEAR
+};
+
+struct mouse_ring_slot {
+    __u64 seq; // position + 1 of the record held, 0 while a producer is rewriting the slot
+    struct mouse_event_record rec;
+};
+
+// Ring state returned by MOUSE_LOGGER_GET_RING_INFO
+struct mouse_ring_info {
+    __u32 capacity;    // records kept before the oldest is overwritten
+    __u32 record_size; // sizeof(struct mouse_event_record)
+    __u64 head;        // total records ever logged into the current ring
+    __u64 dropped;     // records overwritten before a reader got to them, summed over all readers
+};
+
+// Wakeup coalescing, set per open file with MOUSE_LOGGER_SET_WAKEUP. A blocked read or poll is
+// woken once watermark events are pending, or timeout_us after the first unread event arrived.
+// The default (watermark 1) wakes on every event; timeout_us 0 means wait for the watermark only.
+struct mouse_wakeup_config {
+    __u32 watermark;
+    __u32 timeout_us;
+};
+
+// Per open file filter, set with MOUSE_LOGGER_SET_FILTER. Frames are stripped down to the kinds
+// (and buttons) selected and dropped if nothing is left, before they are copied or rendered.
+// SYN_DROPPED records always pass. The default passes everything.
+#define MOUSE_FILTER_MOTION  (1u << 0) // rel_x / rel_y
+#define MOUSE_FILTER_PRESS   (1u << 1) // pressed bits
+#define MOUSE_FILTER_RELEASE (1u << 2) // released bits
+#define MOUSE_FILTER_WHEEL   (1u << 3) // wheel / hwheel
+#define MOUSE_FILTER_ALL     0xfu
+
+struct mouse_filter {
+    __u32 kinds;       // MOUSE_FILTER_* bits to keep
+    __u32 button_mask; // MOUSE_BTN_* whose presses / releases are kept, 0 = all buttons
+    __u64 device_mask; // bit n keeps device id n, 0 = all devices
+    __u32 min_motion;  // motion-only frames with |rel_x| + |rel_y| below this are dropped
+    __u32 accumulate;  // sum motion of up to this many frames of a device into one record (0/1 = off),
+                       // fewer if the read has drained everything logged so far
+};
+
+// Driver wide counters returned by MOUSE_LOGGER_GET_STATS (also in /proc/mouse_stats), summed
+// over all CPUs. The *_ns totals and histograms are only filled while the timing module
+// parameter is on. Histogram bucket n counts values from 2^n up to 2^(n+1) - 1 nanoseconds.
+#define MOUSE_STATS_BUCKETS 32
+
+struct mouse_stats {
+    __u64 events;       // input values seen by the handler
+    __u64 frames;       // frame records built from them
+    __u64 filtered;     // records skipped by reader filters
+    __u64 dropped;      // records overwritten before a reader got to them
+    __u64 reads;        // read() calls that returned data
+    __u64 bytes_copied; // bytes those reads copied to user space
+    __u64 wakeups;      // wait queue wakeups made by producers
+    __u64 timing;       // 1 if timing is on right now
+    __u64 handler_ns;   // total time spent in the input handler
+    __u64 log_ns;       // total time spent storing records in rings
+    __u64 log_hist[MOUSE_STATS_BUCKETS];     // time to store one record
+    __u64 latency_hist[MOUSE_STATS_BUCKETS]; // frame timestamp to copy_to_user
+};
+
+// Latest accumulated state of each device, for consumers that want "where is the pointer and what is
+// held" rather than the event history. mmap() one page at offset MOUSE_STATE_PGOFF * page size of any
+// logger node (read-only), or copy it with MOUSE_LOGGER_GET_STATE. Entry n belongs to device id n;
+// entry 0 sums up every device. Each entry has its own seq counter, odd while the driver updates it:
+// read seq, copy the entry, read seq again, and retry if it was odd or changed.
+#define MOUSE_STATE_PGOFF   0x10000 // far past the end of the largest ring
+#define MOUSE_STATE_DEVICES 32      // one per minor
+
+struct mouse_device_state {
+    __u32 seq;
+    __u16 connected;    // 1 while the device is connected (always 1 for entry 0)
+    __u16 buttons;      // MOUSE_BTN_* held, 0 once unplugged or disabled (entry 0: held on any device)
+    __s64 x;            // rel_x / rel_y / wheel / hwheel summed since the device connected
+    __s64 y;
+    __s64 wheel;
+    __s64 hwheel;
+    __u64 frames;       // frames summed
+    __u64 timestamp_ns; // of the last frame
+};
+
+struct mouse_state_page {
+    __u32 version;  // MOUSE_LOGGER_ABI_VERSION
+    __u32 count;    // MOUSE_STATE_DEVICES
+    struct mouse_device_state dev[MOUSE_STATE_DEVICES];
+};
+
+// ioctl commands - M is magic number
+#define MOUSE_LOGGER_MAGIC 'M'
+#define MOUSE_LOGGER_CLEAR         _IO(MOUSE_LOGGER_MAGIC, 1)
+#define MOUSE_LOGGER_SET_FORMAT    _IOW(MOUSE_LOGGER_MAGIC, 2, int)
+#define MOUSE_LOGGER_GET_VERSION   _IOR(MOUSE_LOGGER_MAGIC, 3, int)
+#define MOUSE_LOGGER_SET_CAPACITY  _IOW(MOUSE_LOGGER_MAGIC, 4, __u32) // resizing drops unread records
+#define MOUSE_LOGGER_GET_RING_INFO _IOR(MOUSE_LOGGER_MAGIC, 5, struct mouse_ring_info)
+#define MOUSE_LOGGER_WAIT          _IOW(MOUSE_LOGGER_MAGIC, 6, __u64) // sleep until position is written
+#define MOUSE_LOGGER_SET_WAKEUP    _IOW(MOUSE_LOGGER_MAGIC, 7, struct mouse_wakeup_config)
+#define MOUSE_LOGGER_SET_FILTER    _IOW(MOUSE_LOGGER_MAGIC, 8, struct mouse_filter)
+#define MOUSE_LOGGER_GET_STATS     _IOR(MOUSE_LOGGER_MAGIC, 9, struct mouse_stats)
+#define MOUSE_LOGGER_GET_STATE     _IOR(MOUSE_LOGGER_MAGIC, 10, struct mouse_state_page) // each entry consistent
+
+#endif // MOUSE_LOGGER_H
@@ -0,0 +1,222 @@
+// The event ring and the text rendering of its records, kept apart from the driver so they have
+// no dependency on devices, streams or readers - a test module can include this header and
+// exercise them on their own.
+#ifndef MOUSE_RING_H
+#define MOUSE_RING_H
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/input.h>
+
+#include "mouse_logger.h"
+
+// Ring of binary event records - text is only rendered when someone reads
+// Producers never lock: each claims a position by bumping head and publishes the record
+// by storing position + 1 into the slot's seq. Readers check seq before and after copying a
+// record, so a slot that got overwritten underneath them is detected instead of returned torn.
+// The header page and slots are one vmalloc_user() area so the same memory can be mmap'd.
+struct mouse_ring {
+    struct mouse_ring_header *hdr; // start of the shared area
+    struct mouse_ring_slot *slots; // follows the header page
+    atomic64_t *head; // hdr->data_head, next position handed to a producer
+    u32 capacity; // number of slots, power of two
+    u32 generation; // changes on every resize so readers know their cursor is stale
+    size_t size; // bytes in the shared area
+};
+
+// Capacity limits in records - the ring is vmalloc'd so large captures are fine
+#define RING_MIN_CAPACITY 16
+#define RING_MAX_CAPACITY (1 << 20)
+
+// Allocates an empty ring, capacity is clamped and rounded up to a power of two
+static inline struct mouse_ring *ring_alloc(unsigned int capacity, u32 generation) {
+    struct mouse_ring *ring;
+
+    BUILD_BUG_ON(sizeof(atomic64_t) != sizeof(__u64));
+
+    ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+    if (!ring) return NULL;
+
+    capacity = roundup_pow_of_two(clamp_t(unsigned int, capacity, RING_MIN_CAPACITY, RING_MAX_CAPACITY));
+    ring->size = PAGE_SIZE + PAGE_ALIGN(capacity * sizeof(struct mouse_ring_slot));
+    ring->hdr = vmalloc_user(ring->size); // zeroed, and allowed to be remapped to user space
+    if (!ring->hdr) {
+        kfree(ring);
+        return NULL;
+    }
+
+    ring->slots = (void *)ring->hdr + PAGE_SIZE;
+    ring->head = (atomic64_t *)&ring->hdr->data_head;
+    ring->capacity = capacity;
+    ring->generation = generation;
+
+    ring->hdr->version = MOUSE_LOGGER_ABI_VERSION;
+    ring->hdr->capacity = capacity;
+    ring->hdr->slot_size = sizeof(struct mouse_ring_slot);
+    ring->hdr->data_offset = PAGE_SIZE;
+    return ring;
+}
+
+// Frees a ring - nobody may be using it any more
+static inline void ring_free(struct mouse_ring *ring) {
+    vfree(ring->hdr);
+    kfree(ring);
+}
+
+// Stores a record at the next position and returns that position.
+// Wait-free, safe from any context; the oldest record is simply overwritten when the ring is full,
+// same cost as any insert. Callers that want readers to notice must order their wakeup check after
+// this with smp_mb().
+static inline u64 ring_push(struct mouse_ring *ring, const struct mouse_event_record *rec) {
+    u64 pos = atomic64_inc_return(ring->head) - 1;
+    struct mouse_ring_slot *slot = &ring->slots[pos & (ring->capacity - 1)];
+
+    WRITE_ONCE(slot->seq, 0); // mark the slot busy before touching the record
+    smp_wmb();
+    slot->rec = *rec;
+    smp_store_release(&slot->seq, pos + 1); // publish
+    return pos;
+}
+
+// Results of ring_fetch()
+enum { RING_OK, RING_EMPTY, RING_LAPPED };
+
+// Copies the record at position pos out of the ring without blocking producers
+static inline int ring_fetch(struct mouse_ring *ring, u64 pos, struct mouse_event_record *out) {
+    struct mouse_ring_slot *slot = &ring->slots[pos & (ring->capacity - 1)];
+
+    if (smp_load_acquire(&slot->seq) == pos + 1) {
+        *out = slot->rec;
+        smp_rmb();
+        if (READ_ONCE(slot->seq) == pos + 1) return RING_OK;
+    }
+    // Either the record isn't published yet, or producers have already wrapped past it
+    if ((s64)(atomic64_read(ring->head) - pos) > (s64)ring->capacity) return RING_LAPPED;
+    return RING_EMPTY;
+}
+
+// Oldest position still stored in the ring
+static inline u64 ring_oldest(struct mouse_ring *ring) {
+    u64 head = atomic64_read(ring->head);
+
+    return head > ring->capacity ? head - ring->capacity : 0;
+}
+
+// True once the record at pos is written (or already overwritten), i.e. a read won't block
+static inline bool ring_ready(struct mouse_ring *ring, u64 pos) {
+    return smp_load_acquire(&ring->slots[pos & (ring->capacity - 1)].seq) > pos ||
+           (s64)(atomic64_read(ring->head) - pos) > (s64)ring->capacity;
+}
+
+// Moves a cursor that ring_fetch() reported lapped to the oldest record still stored, returns how
+// many records it skipped. The oldest position is read once, producers keep moving it.
+static inline u64 ring_skip_lapped(struct mouse_ring *ring, u64 *cursor) {
+    u64 oldest = ring_oldest(ring);
+    u64 skipped = oldest > *cursor ? oldest - *cursor : 0;
+
+    *cursor += skipped;
+    return skipped;
+}
+
+// Fills in the EV_SYN/SYN_DROPPED record a lapped reader gets in place of the lost events
+static inline void ring_lost_record(struct mouse_event_record *rec, u64 lost, u64 timestamp_ns) {
+    memset(rec, 0, sizeof(*rec));
+    rec->timestamp_ns = timestamp_ns;
+    rec->type = EV_SYN;
+    rec->code = SYN_DROPPED;
+    rec->value = min_t(u64, lost, S32_MAX);
+}
+
+// Renders one record as text lines, returns their total length (0 if there is nothing to show)
+// A frame becomes a "<Button> Click" line per press, then one move line and one wheel line
+static inline int render_text(const struct mouse_event_record *rec, char *buf, size_t size) {
+    // Names for the MOUSE_BTN_* bits, in bit order
+    static const char *const button_names[] = {
+        "Left", "Right", "Middle", "Side", "Extra", "Forward", "Back", "Task",
+    };
+    int len = 0;
+    int i;
+
+    if (rec->type == EV_SYN && rec->code == SYN_DROPPED)
+        return snprintf(buf, size, "Lapped: %d events lost\n", rec->value);
+    if (rec->type != EV_SYN || rec->code != SYN_REPORT)
+        return snprintf(buf, size, "Event: type=%u code=%u value=%d\n", rec->type, rec->code, rec->value);
+
+    for (i = 0; i < ARRAY_SIZE(button_names); i++) {
+        if (rec->pressed & BIT(i)) len += scnprintf(buf + len, size - len, "%s Click\n", button_names[i]);
+    }
+    if (rec->rel_x || rec->rel_y)
+        len += scnprintf(buf + len, size - len, "Mouse Move: X=%d Y=%d\n", rec->rel_x, rec->rel_y);
+    if (rec->wheel || rec->hwheel)
+        len += scnprintf(buf + len, size - len, "Wheel: V=%d H=%d\n", rec->wheel, rec->hwheel);
+    return len;
+}
+
+// Delta state of a MOUSE_FMT_COMPACT stream - what the previous record looked like
+struct compact_state {
+    u64 timestamp_ns;
+    u16 device_id;
+    u16 buttons;
+};
+
+static inline u8 *put_varint(u8 *p, u64 v) {
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static inline u64 zigzag(s64 v) {
+    return ((u64)v << 1) ^ (u64)(v >> 63);
+}
+
+// Encodes one record as MOUSE_FMT_COMPACT (see mouse_logger.h) into buf, which must hold
+// MOUSE_COMPACT_MAX bytes, and moves the state past it. Returns the encoded length.
+static inline int compact_encode(struct compact_state *st, const struct mouse_event_record *rec, u8 *buf) {
+    bool frame = rec->type == EV_SYN && rec->code == SYN_REPORT;
+    u8 flags = 0;
+    u8 *p = buf + 1;
+
+    if (rec->device_id != st->device_id) flags |= MOUSE_COMPACT_DEVICE;
+    if (rec->rel_x || rec->rel_y) flags |= MOUSE_COMPACT_MOTION;
+    if (rec->wheel || rec->hwheel) flags |= MOUSE_COMPACT_WHEEL;
+    if (rec->buttons != st->buttons) flags |= MOUSE_COMPACT_BUTTONS;
+    if (rec->pressed || rec->released) flags |= MOUSE_COMPACT_CHANGES;
+    if (!frame) flags |= MOUSE_COMPACT_OTHER;
+
+    // records of a merged stream can be a little out of order, hence signed deltas
+    p = put_varint(p, zigzag(rec->timestamp_ns - st->timestamp_ns));
+    if (flags & MOUSE_COMPACT_DEVICE) p = put_varint(p, rec->device_id);
+    if (flags & MOUSE_COMPACT_MOTION) {
+        p = put_varint(p, zigzag(rec->rel_x));
+        p = put_varint(p, zigzag(rec->rel_y));
+    }
+    if (flags & MOUSE_COMPACT_WHEEL) {
+        p = put_varint(p, zigzag(rec->wheel));
+        p = put_varint(p, zigzag(rec->hwheel));
+    }
+    if (flags & MOUSE_COMPACT_BUTTONS) *p++ = rec->buttons;
+    if (flags & MOUSE_COMPACT_CHANGES) {
+        *p++ = rec->pressed;
+        *p++ = rec->released;
+    }
+    if (flags & MOUSE_COMPACT_OTHER) {
+        p = put_varint(p, rec->type);
+        p = put_varint(p, rec->code);
+        p = put_varint(p, zigzag(rec->value));
+    }
+    buf[0] = flags;
+
+    st->timestamp_ns = rec->timestamp_ns;
+    st->device_id = rec->device_id;
+    st->buttons = rec->buttons;
+    return p - buf;
+}
+
+#endif // MOUSE_RING_H
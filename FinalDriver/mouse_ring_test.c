@@ -0,0 +1,433 @@
+// KUnit tests for mouse_ring.h - the event ring, text rendering and the compact encoding.
+// Run on UML with  ./tools/testing/kunit/kunit.py run --kunitconfig=<this directory>
+// (see README.md), or build as a module with  make kunit  and load it on a KUnit kernel.
+// The bench_* cases print ns/insert and ns/drain for each capacity / batch size instead of checking anything.
+#include <kunit/test.h>
+#include <linux/completion.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+
+#include "mouse_ring.h"
+
+#define TEST_CAPACITY 16
+#define DRAIN_RECORDS 200000
+#define BENCH_RECORDS (1 << 20)
+#define BENCH_DRAIN_RECORDS (1 << 18) // per format, a multiple of every batch size
+
+// Record n carries n in rel_x and ~n in rel_y, so a torn copy can't pass as a real record
+static void make_record(struct mouse_event_record *rec, u64 n) {
+    memset(rec, 0, sizeof(*rec));
+    rec->timestamp_ns = n;
+    rec->type = EV_SYN;
+    rec->code = SYN_REPORT;
+    rec->rel_x = (s32)n;
+    rec->rel_y = ~(s32)n;
+}
+
+static void push_records(struct mouse_ring *ring, u64 count) {
+    struct mouse_event_record rec;
+    u64 i;
+
+    for (i = 0; i < count; i++) {
+        make_record(&rec, atomic64_read(ring->head));
+        ring_push(ring, &rec);
+    }
+}
+
+// Every test gets an empty ring of TEST_CAPACITY records in test->priv
+static int mouse_ring_test_init(struct kunit *test) {
+    test->priv = ring_alloc(TEST_CAPACITY, 0);
+    KUNIT_ASSERT_NOT_NULL(test, test->priv);
+    return 0;
+}
+
+static void mouse_ring_test_exit(struct kunit *test) {
+    ring_free(test->priv);
+}
+
+static void ring_alloc_rounds_capacity(struct kunit *test) {
+    struct mouse_ring *ring = test->priv;
+    struct mouse_ring *odd = ring_alloc(TEST_CAPACITY + 1, 7);
+    struct mouse_ring *tiny = ring_alloc(1, 0);
+
+    KUNIT_EXPECT_EQ(test, ring->capacity, (u32)TEST_CAPACITY);
+    KUNIT_EXPECT_EQ(test, ring->hdr->capacity, (u32)TEST_CAPACITY);
+    KUNIT_EXPECT_EQ(test, ring->hdr->data_offset, (u32)PAGE_SIZE);
+    KUNIT_EXPECT_EQ(test, ring_oldest(ring), 0ull);
+
+    if (odd) {
+        KUNIT_EXPECT_EQ(test, odd->capacity, (u32)(TEST_CAPACITY * 2));
+        KUNIT_EXPECT_EQ(test, odd->generation, 7u);
+        ring_free(odd);
+    }
+    if (tiny) {
+        KUNIT_EXPECT_EQ(test, tiny->capacity, (u32)RING_MIN_CAPACITY);
+        ring_free(tiny);
+    }
+}
+
+static void ring_push_fetch_in_order(struct kunit *test) {
+    struct mouse_ring *ring = test->priv;
+    struct mouse_event_record rec;
+    u64 pos;
+
+    KUNIT_EXPECT_EQ(test, ring_fetch(ring, 0, &rec), RING_EMPTY);
+    KUNIT_EXPECT_FALSE(test, ring_ready(ring, 0));
+
+    push_records(ring, 3);
+    for (pos = 0; pos < 3; pos++) {
+        KUNIT_EXPECT_TRUE(test, ring_ready(ring, pos));
+        KUNIT_ASSERT_EQ(test, ring_fetch(ring, pos, &rec), RING_OK);
+        KUNIT_EXPECT_EQ(test, rec.rel_x, (s32)pos);
+        KUNIT_EXPECT_EQ(test, rec.timestamp_ns, pos);
+    }
+    KUNIT_EXPECT_EQ(test, ring_fetch(ring, 3, &rec), RING_EMPTY);
+    KUNIT_EXPECT_FALSE(test, ring_ready(ring, 3));
+    KUNIT_EXPECT_EQ(test, ring_oldest(ring), 0ull);
+}
+
+// Exactly full: nothing is lost yet. One more: position 0 is lapped, 1 becomes the oldest.
+static void ring_lap_boundary(struct kunit *test) {
+    struct mouse_ring *ring = test->priv;
+    struct mouse_event_record rec;
+
+    push_records(ring, TEST_CAPACITY);
+    KUNIT_EXPECT_EQ(test, ring_oldest(ring), 0ull);
+    KUNIT_EXPECT_EQ(test, ring_fetch(ring, 0, &rec), RING_OK);
+    KUNIT_EXPECT_EQ(test, ring_fetch(ring, TEST_CAPACITY - 1, &rec), RING_OK);
+    KUNIT_EXPECT_EQ(test, ring_fetch(ring, TEST_CAPACITY, &rec), RING_EMPTY);
+
+    push_records(ring, 1);
+    KUNIT_EXPECT_EQ(test, ring_oldest(ring), 1ull);
+    KUNIT_EXPECT_EQ(test, ring_fetch(ring, 0, &rec), RING_LAPPED);
+    KUNIT_EXPECT_TRUE(test, ring_ready(ring, 0)); // lapped counts as ready, the read reports the loss
+    KUNIT_ASSERT_EQ(test, ring_fetch(ring, 1, &rec), RING_OK);
+    KUNIT_EXPECT_EQ(test, rec.rel_x, 1);
+    KUNIT_ASSERT_EQ(test, ring_fetch(ring, TEST_CAPACITY, &rec), RING_OK);
+    KUNIT_EXPECT_EQ(test, rec.rel_x, TEST_CAPACITY);
+}
+
+// Many laps: only the newest capacity records are readable, each from its own slot
+static void ring_overflow_keeps_newest(struct kunit *test) {
+    struct mouse_ring *ring = test->priv;
+    struct mouse_event_record rec;
+    u64 total = 10 * TEST_CAPACITY + 5;
+    u64 pos;
+
+    push_records(ring, total);
+    KUNIT_EXPECT_EQ(test, (u64)atomic64_read(ring->head), total);
+    KUNIT_EXPECT_EQ(test, ring_oldest(ring), total - TEST_CAPACITY);
+
+    for (pos = 0; pos < total - TEST_CAPACITY; pos++)
+        KUNIT_EXPECT_EQ(test, ring_fetch(ring, pos, &rec), RING_LAPPED);
+    for (pos = total - TEST_CAPACITY; pos < total; pos++) {
+        KUNIT_ASSERT_EQ(test, ring_fetch(ring, pos, &rec), RING_OK);
+        KUNIT_EXPECT_EQ(test, rec.rel_x, (s32)pos);
+        KUNIT_EXPECT_EQ(test, rec.rel_y, ~(s32)pos);
+    }
+    KUNIT_EXPECT_EQ(test, ring_fetch(ring, total, &rec), RING_EMPTY);
+}
+
+// Positions far from 0 - the slot index is the low bits, seq must still match the full position
+static void ring_wraps_at_large_positions(struct kunit *test) {
+    struct mouse_ring *ring = test->priv;
+    struct mouse_event_record rec;
+    u64 start = (1ull << 40) - 3;
+    u64 pos;
+
+    atomic64_set(ring->head, start);
+    push_records(ring, 6);
+    KUNIT_EXPECT_EQ(test, ring_oldest(ring), start + 6 - TEST_CAPACITY);
+    for (pos = start; pos < start + 6; pos++) {
+        KUNIT_ASSERT_EQ(test, ring_fetch(ring, pos, &rec), RING_OK);
+        KUNIT_EXPECT_EQ(test, rec.timestamp_ns, pos);
+    }
+    // stale slot contents from an older lap never pass for the position asked for
+    KUNIT_EXPECT_NE(test, ring_fetch(ring, start - TEST_CAPACITY, &rec), RING_OK);
+    KUNIT_EXPECT_EQ(test, ring_fetch(ring, start + 6, &rec), RING_EMPTY);
+}
+
+struct drain_producer {
+    struct mouse_ring *ring;
+    struct completion done;
+};
+
+static int drain_producer_fn(void *arg) {
+    struct drain_producer *p = arg;
+    struct mouse_event_record rec;
+    u64 i;
+
+    for (i = 0; i < DRAIN_RECORDS; i++) {
+        make_record(&rec, i);
+        ring_push(p->ring, &rec);
+        if (!(i % 1024)) cond_resched();
+    }
+    complete(&p->done);
+    return 0;
+}
+
+// A producer thread fills the ring while this thread drains it, skipping ahead when lapped.
+// Every record returned must be whole and in order, and returned + lost must add up.
+static void ring_concurrent_drain(struct kunit *test) {
+    struct drain_producer p = { .ring = test->priv };
+    struct mouse_event_record rec;
+    struct task_struct *task;
+    u64 cursor = 0, returned = 0, lost = 0;
+    bool ok = true;
+
+    init_completion(&p.done);
+    task = kthread_run(drain_producer_fn, &p, "mouse_ring_test");
+    KUNIT_ASSERT_FALSE(test, IS_ERR(task));
+
+    while (cursor < DRAIN_RECORDS && ok) {
+        switch (ring_fetch(p.ring, cursor, &rec)) {
+            case RING_OK:
+                ok = rec.rel_x == (s32)cursor && rec.rel_y == ~(s32)cursor && rec.timestamp_ns == cursor;
+                KUNIT_EXPECT_TRUE_MSG(test, ok, "bad record at position %llu", cursor);
+                cursor++;
+                returned++;
+                break;
+            case RING_LAPPED:
+                lost += ring_skip_lapped(p.ring, &cursor); // one look at the oldest for both
+                break;
+            default:
+                cond_resched(); // producer hasn't got there yet
+        }
+    }
+    wait_for_completion(&p.done); // the ring outlives the producer
+
+    if (ok) KUNIT_EXPECT_EQ(test, returned + lost, (u64)DRAIN_RECORDS);
+    kunit_info(test, "drained %llu records, %llu lapped\n", returned, lost);
+}
+
+// What a reader does when lapped (reader_peek() in the driver): skip to the oldest record, hand out
+// one SYN_DROPPED record with the number of events lost, then carry on with the oldest record
+static void ring_reader_lap_reports_lost(struct kunit *test) {
+    struct mouse_ring *ring = test->priv;
+    struct mouse_event_record rec;
+    char line[64];
+    u64 cursor = 0, lost;
+
+    push_records(ring, TEST_CAPACITY + 5);
+    KUNIT_ASSERT_EQ(test, ring_fetch(ring, cursor, &rec), RING_LAPPED);
+    lost = ring_skip_lapped(ring, &cursor);
+    KUNIT_EXPECT_EQ(test, lost, 5ull);
+    KUNIT_EXPECT_EQ(test, cursor, 5ull);
+
+    ring_lost_record(&rec, lost, 1234);
+    KUNIT_EXPECT_EQ(test, rec.type, (u16)EV_SYN);
+    KUNIT_EXPECT_EQ(test, rec.code, (u16)SYN_DROPPED);
+    KUNIT_EXPECT_EQ(test, rec.value, 5);
+    KUNIT_EXPECT_EQ(test, rec.timestamp_ns, 1234ull);
+    render_text(&rec, line, sizeof(line));
+    KUNIT_EXPECT_STREQ(test, line, "Lapped: 5 events lost\n");
+
+    KUNIT_ASSERT_EQ(test, ring_fetch(ring, cursor, &rec), RING_OK);
+    KUNIT_EXPECT_EQ(test, rec.rel_x, 5);
+
+    // a cursor that isn't behind anything is left alone
+    KUNIT_EXPECT_EQ(test, ring_skip_lapped(ring, &cursor), 0ull);
+    KUNIT_EXPECT_EQ(test, cursor, 5ull);
+
+    // more than an s32 worth lost still reports a positive count
+    ring_lost_record(&rec, 1ull << 40, 0);
+    KUNIT_EXPECT_EQ(test, rec.value, S32_MAX);
+}
+
+static void render_text_frame(struct kunit *test) {
+    struct mouse_event_record rec = {
+        .type = EV_SYN, .code = SYN_REPORT,
+        .pressed = MOUSE_BTN_LEFT | MOUSE_BTN_RIGHT,
+        .rel_x = 3, .rel_y = -2, .wheel = 1,
+    };
+    char buf[256];
+    int len = render_text(&rec, buf, sizeof(buf));
+
+    KUNIT_EXPECT_EQ(test, len, (int)strlen(buf));
+    KUNIT_EXPECT_STREQ(test, buf, "Left Click\nRight Click\nMouse Move: X=3 Y=-2\nWheel: V=1 H=0\n");
+
+    // a frame with only a release shows nothing
+    memset(&rec, 0, sizeof(rec));
+    rec.type = EV_SYN;
+    rec.code = SYN_REPORT;
+    rec.released = MOUSE_BTN_LEFT;
+    KUNIT_EXPECT_EQ(test, render_text(&rec, buf, sizeof(buf)), 0);
+}
+
+static void render_text_other_records(struct kunit *test) {
+    struct mouse_event_record rec = { .type = EV_SYN, .code = SYN_DROPPED, .value = 42 };
+    char buf[256];
+
+    render_text(&rec, buf, sizeof(buf));
+    KUNIT_EXPECT_STREQ(test, buf, "Lapped: 42 events lost\n");
+
+    rec.type = EV_KEY;
+    rec.code = BTN_LEFT;
+    rec.value = 1;
+    render_text(&rec, buf, sizeof(buf));
+    KUNIT_EXPECT_STREQ(test, buf, "Event: type=1 code=272 value=1\n");
+}
+
+static void compact_encode_deltas(struct kunit *test) {
+    struct compact_state st = { 0 };
+    struct mouse_event_record rec = {
+        .timestamp_ns = 1000, .device_id = 1, .type = EV_SYN, .code = SYN_REPORT,
+        .buttons = MOUSE_BTN_LEFT, .pressed = MOUSE_BTN_LEFT, .rel_x = 3, .rel_y = -2,
+    };
+    // flags, ts 2000 (zigzag 1000), device 1, x 6, y 3, buttons, pressed, released
+    static const u8 first[] = { 0x1b, 0xd0, 0x0f, 0x01, 0x06, 0x03, 0x01, 0x01, 0x00 };
+    // no flags, ts delta -100 -> zigzag 199
+    static const u8 second[] = { 0x00, 0xc7, 0x01 };
+    u8 buf[MOUSE_COMPACT_MAX];
+    int len;
+
+    len = compact_encode(&st, &rec, buf);
+    KUNIT_ASSERT_EQ(test, len, (int)sizeof(first));
+    KUNIT_EXPECT_MEMEQ(test, buf, first, sizeof(first));
+    KUNIT_EXPECT_EQ(test, st.timestamp_ns, 1000ull);
+    KUNIT_EXPECT_EQ(test, st.device_id, (u16)1);
+
+    // merged streams can go slightly back in time, the delta is signed
+    rec.timestamp_ns = 900;
+    rec.pressed = 0;
+    rec.rel_x = rec.rel_y = 0;
+    len = compact_encode(&st, &rec, buf);
+    KUNIT_ASSERT_EQ(test, len, (int)sizeof(second));
+    KUNIT_EXPECT_MEMEQ(test, buf, second, sizeof(second));
+}
+
+// Every field at its most expensive value still fits in MOUSE_COMPACT_MAX
+static void compact_encode_worst_case(struct kunit *test) {
+    struct compact_state st = { .timestamp_ns = 1ull << 63 }; // delta of S64_MIN, a 10 byte varint
+    struct mouse_event_record rec = {
+        .timestamp_ns = 0, .device_id = U16_MAX, .type = U16_MAX, .code = U16_MAX,
+        .buttons = U16_MAX, .pressed = U16_MAX, .released = U16_MAX, .value = S32_MIN,
+        .rel_x = S32_MIN, .rel_y = S32_MIN, .wheel = S32_MIN, .hwheel = S32_MIN,
+    };
+    u8 buf[MOUSE_COMPACT_MAX];
+
+    KUNIT_EXPECT_LE(test, compact_encode(&st, &rec, buf), MOUSE_COMPACT_MAX);
+    KUNIT_EXPECT_EQ(test, zigzag(-1), 1ull);
+    KUNIT_EXPECT_EQ(test, zigzag(1), 2ull);
+    KUNIT_EXPECT_EQ(test, zigzag(S64_MIN), U64_MAX);
+}
+
+// Ring sizes the benches run with - smallest, the driver default and the largest allowed
+static const unsigned int bench_capacities[] = { RING_MIN_CAPACITY, 4096, RING_MAX_CAPACITY };
+
+static void bench_capacity_desc(const unsigned int *capacity, char *desc) {
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "capacity %u", *capacity);
+}
+KUNIT_ARRAY_PARAM(bench_push, bench_capacities, bench_capacity_desc);
+
+// Records copied out per pass, like one read() taking 1, 16 or 256 binary records
+struct bench_drain_param {
+    unsigned int capacity;
+    unsigned int batch;
+};
+
+static const struct bench_drain_param bench_drain_params[] = {
+    { RING_MIN_CAPACITY, 1 }, { RING_MIN_CAPACITY, 16 },
+    { 4096, 1 }, { 4096, 16 }, { 4096, 256 },
+    { RING_MAX_CAPACITY, 1 }, { RING_MAX_CAPACITY, 16 }, { RING_MAX_CAPACITY, 256 },
+};
+
+static void bench_drain_desc(const struct bench_drain_param *param, char *desc) {
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "capacity %u batch %u", param->capacity, param->batch);
+}
+KUNIT_ARRAY_PARAM(bench_drain, bench_drain_params, bench_drain_desc);
+
+// Producer cost of one record, ring kept well past full so evictions are included
+static void bench_ring_push(struct kunit *test) {
+    const unsigned int *capacity = test->param_value;
+    struct mouse_ring *ring = ring_alloc(*capacity, 0);
+    struct mouse_event_record rec;
+    u64 start, ns, i;
+
+    KUNIT_ASSERT_NOT_NULL(test, ring);
+    make_record(&rec, 0);
+    start = ktime_get_ns();
+    for (i = 0; i < BENCH_RECORDS; i++) ring_push(ring, &rec);
+    ns = ktime_get_ns() - start;
+    ring_free(ring);
+
+    kunit_info(test, "capacity %u: %llu ns/insert (%d records)\n", *capacity, div_u64(ns, BENCH_RECORDS),
+               BENCH_RECORDS);
+}
+
+// Reader cost of one record, fetched batch records at a time, as binary and rendered for each format
+static void bench_ring_drain(struct kunit *test) {
+    const struct bench_drain_param *param = test->param_value;
+    struct mouse_ring *ring = ring_alloc(param->capacity, 0);
+    struct mouse_event_record *batch;
+    struct compact_state st = { 0 };
+    u64 start, fetch_ns, text_ns, compact_ns, done, mask;
+    unsigned int i;
+    char buf[256];
+
+    KUNIT_ASSERT_NOT_NULL(test, ring);
+    batch = kcalloc(param->batch, sizeof(*batch), GFP_KERNEL);
+    if (!batch) {
+        ring_free(ring);
+        KUNIT_FAIL(test, "no memory for the batch");
+        return;
+    }
+    push_records(ring, ring->capacity); // positions 0 .. capacity - 1 all readable
+    mask = ring->capacity - 1;
+
+    start = ktime_get_ns();
+    for (done = 0; done < BENCH_DRAIN_RECORDS; done += param->batch) {
+        for (i = 0; i < param->batch; i++) ring_fetch(ring, (done + i) & mask, &batch[i]);
+    }
+    fetch_ns = ktime_get_ns() - start;
+
+    start = ktime_get_ns();
+    for (done = 0; done < BENCH_DRAIN_RECORDS; done += param->batch) {
+        for (i = 0; i < param->batch; i++) ring_fetch(ring, (done + i) & mask, &batch[i]);
+        for (i = 0; i < param->batch; i++) render_text(&batch[i], buf, sizeof(buf));
+    }
+    text_ns = ktime_get_ns() - start;
+
+    start = ktime_get_ns();
+    for (done = 0; done < BENCH_DRAIN_RECORDS; done += param->batch) {
+        for (i = 0; i < param->batch; i++) ring_fetch(ring, (done + i) & mask, &batch[i]);
+        for (i = 0; i < param->batch; i++) compact_encode(&st, &batch[i], (u8 *)buf);
+    }
+    compact_ns = ktime_get_ns() - start;
+    kfree(batch);
+    ring_free(ring);
+
+    kunit_info(test, "capacity %u batch %u: %llu ns/record binary, %llu text, %llu compact\n",
+               param->capacity, param->batch, div_u64(fetch_ns, BENCH_DRAIN_RECORDS),
+               div_u64(text_ns, BENCH_DRAIN_RECORDS), div_u64(compact_ns, BENCH_DRAIN_RECORDS));
+}
+
+static struct kunit_case mouse_ring_test_cases[] = {
+    KUNIT_CASE(ring_alloc_rounds_capacity),
+    KUNIT_CASE(ring_push_fetch_in_order),
+    KUNIT_CASE(ring_lap_boundary),
+    KUNIT_CASE(ring_overflow_keeps_newest),
+    KUNIT_CASE(ring_wraps_at_large_positions),
+    KUNIT_CASE_SLOW(ring_concurrent_drain),
+    KUNIT_CASE(ring_reader_lap_reports_lost),
+    KUNIT_CASE(render_text_frame),
+    KUNIT_CASE(render_text_other_records),
+    KUNIT_CASE(compact_encode_deltas),
+    KUNIT_CASE(compact_encode_worst_case),
+    KUNIT_CASE_PARAM_ATTR(bench_ring_push, bench_push_gen_params, { .speed = KUNIT_SPEED_SLOW }),
+    KUNIT_CASE_PARAM_ATTR(bench_ring_drain, bench_drain_gen_params, { .speed = KUNIT_SPEED_SLOW }),
+    {}
+};
+
+static struct kunit_suite mouse_ring_test_suite = {
+    .name = "mouse_ring",
+    .init = mouse_ring_test_init,
+    .exit = mouse_ring_test_exit,
+    .test_cases = mouse_ring_test_cases,
+};
+kunit_test_suite(mouse_ring_test_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("KUnit tests for the mouse logger event ring");
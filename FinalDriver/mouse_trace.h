@@ -0,0 +1,135 @@
+// Tracepoints for the mouse logger - see them with
+//   sudo perf trace -e 'mouse_logger:*'   or   sudo trace-cmd record -e mouse_logger
+// They cost a patched-out branch while nobody is tracing.
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mouse_logger
+
+#if !defined(_MOUSE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MOUSE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// One input value reaching the handler, before it is folded into a frame
+TRACE_EVENT(mouse_receive,
+    TP_PROTO(u16 device_id, u16 type, u16 code, s32 value),
+    TP_ARGS(device_id, type, code, value),
+
+    TP_STRUCT__entry(
+        __field(u16, device_id)
+        __field(u16, type)
+        __field(u16, code)
+        __field(s32, value)
+    ),
+
+    TP_fast_assign(
+        __entry->device_id = device_id;
+        __entry->type = type;
+        __entry->code = code;
+        __entry->value = value;
+    ),
+
+    TP_printk("device=%u type=%u code=%u value=%d",
+              __entry->device_id, __entry->type, __entry->code, __entry->value)
+);
+
+// A frame record stored at pos in the ring of stream minor; depth is how many records the ring holds
+TRACE_EVENT(mouse_enqueue,
+    TP_PROTO(unsigned int minor, const struct mouse_event_record *rec, u64 pos, u32 capacity),
+    TP_ARGS(minor, rec, pos, capacity),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u16, device_id)
+        __field(u16, pressed)
+        __field(u16, released)
+        __field(s32, rel_x)
+        __field(s32, rel_y)
+        __field(u64, pos)
+        __field(u64, depth)
+        __field(u64, timestamp_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->device_id = rec->device_id;
+        __entry->pressed = rec->pressed;
+        __entry->released = rec->released;
+        __entry->rel_x = rec->rel_x;
+        __entry->rel_y = rec->rel_y;
+        __entry->pos = pos;
+        __entry->depth = min_t(u64, pos + 1, capacity);
+        __entry->timestamp_ns = rec->timestamp_ns;
+    ),
+
+    TP_printk("minor=%u device=%u pressed=%#x released=%#x x=%d y=%d pos=%llu depth=%llu ts=%llu",
+              __entry->minor, __entry->device_id, __entry->pressed, __entry->released,
+              __entry->rel_x, __entry->rel_y, __entry->pos, __entry->depth, __entry->timestamp_ns)
+);
+
+// The ring was full, so storing a record overwrote the one at pos
+TRACE_EVENT(mouse_evict,
+    TP_PROTO(unsigned int minor, u64 pos),
+    TP_ARGS(minor, pos),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, pos)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+    ),
+
+    TP_printk("minor=%u pos=%llu", __entry->minor, __entry->pos)
+);
+
+// A producer woke the readers sleeping on stream minor after publishing pos
+TRACE_EVENT(mouse_wake,
+    TP_PROTO(unsigned int minor, u64 pos),
+    TP_ARGS(minor, pos),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, pos)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+    ),
+
+    TP_printk("minor=%u pos=%llu", __entry->minor, __entry->pos)
+);
+
+// One read() handed records to user space; backlog is what the reader still has to catch up on
+TRACE_EVENT(mouse_drain,
+    TP_PROTO(unsigned int minor, unsigned int records, size_t bytes, u64 backlog),
+    TP_ARGS(minor, records, bytes, backlog),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, records)
+        __field(size_t, bytes)
+        __field(u64, backlog)
+    ),
+
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->records = records;
+        __entry->bytes = bytes;
+        __entry->backlog = backlog;
+    ),
+
+    TP_printk("minor=%u records=%u bytes=%zu backlog=%llu",
+              __entry->minor, __entry->records, __entry->bytes, __entry->backlog)
+);
+
+#endif // _MOUSE_TRACE_H
+
+// This part must be outside the include guard
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mouse_trace
+#include <trace/define_trace.h>
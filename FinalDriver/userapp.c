@@ -1,34 +1,46 @@
 #include <stdio.h>
-#include <fcntl.h>      
-#include <unistd.h>     
-#include <errno.h>      
-#include <sys/ioctl.h>  
-#include <string.h>     
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <string.h>
+#include <linux/input.h>
+
+// record layout and ioctl commands shared with the driver
+#include "mouse_logger.h"
 
 // locates device file
 #define DEVICE_FILE "/dev/mouse_logger_1"
 
-// locates ioctl command to clear buffer
-#define MOUSE_LOGGER_CLEAR _IO('M', 1)
-
-int main() {
-    char buffer[256];  // Buffer to store read data from the device file
-    int fd = open(DEVICE_FILE, O_RDONLY); // Open the device file in read only mode
-
-    // Check if the device file was opened successfully
-    if (fd < 0) {
-        perror("Failed to open device file");
-        return 1;
+// Prints the clicks in one frame record, source names where it was read from
+static void print_clicks(const struct mouse_event_record *rec, const char *source) {
+    if (rec->type == EV_SYN && rec->code == SYN_DROPPED) {
+        fprintf(stderr, "Fell behind, %d events lost\n", rec->value);
+        return;
     }
+    if (rec->pressed & MOUSE_BTN_LEFT) printf("Mouse Event: Left Click (%s, device %u)\n", source, rec->device_id);
+    if (rec->pressed & MOUSE_BTN_RIGHT) printf("Mouse Event: Right Click (%s, device %u)\n", source, rec->device_id);
+    if (rec->pressed & MOUSE_BTN_MIDDLE) printf("Mouse Event: Middle Click (%s, device %u)\n", source, rec->device_id);
+}
 
-    // use ioctl command to clear the buffer before reading new events
-    if (ioctl(fd, MOUSE_LOGGER_CLEAR) < 0) {
-        perror("Failed to clear buffer");
-        close(fd);
-        return 1;
-    }
+// Asks the driver for button presses only - moves are dropped in the kernel before any copying
+static int set_click_filter(int fd) {
+    struct mouse_filter filter = {
+        .kinds = MOUSE_FILTER_PRESS,
+        .button_mask = MOUSE_BTN_LEFT | MOUSE_BTN_RIGHT | MOUSE_BTN_MIDDLE,
+    };
 
-    printf("Listening for mouse clicks...\n");
+    return ioctl(fd, MOUSE_LOGGER_SET_FILTER, &filter);
+}
+
+// Reads text lines rendered by the driver (run with -t)
+static int read_text(int fd) {
+    char buffer[256];  // Buffer to store read data from the device file
 
     while (1) {
         // Read data from the device file into the buffer
@@ -37,29 +49,595 @@ int main() {
         // Check for read errors
         if (bytes_read < 0) {
             perror("Read failed");
-            break;
+            return 1;
         } else if (bytes_read == 0) {
             // If read returns 0, it means there is no data available
             // Normally, this should not happen unless the device is non-blocking
             printf("No data available, but read returned 0. Is the device non-blocking?\n");
-            break;
+            return 1;
         }
 
         buffer[bytes_read] = '\0';
 
         // Process the buffer line by line using strtok() function
+        // the click filter means every line is a click - all mouse inputs can be seen using cat /proc/mouse_events
         char *line = buffer;
         while ((line = strtok(line, "\n")) != NULL) {
-            // filters mouse inputs to only include clicks in userapp - avoid clogging terminal
-            // All mouse inputs can be seen using cat /proc/mouse_events
-            if (strstr(line, "Click") != NULL) {
-                printf("Mouse Event: %s\n", line);
-            }
+            printf("Mouse Event: %s\n", line);
             line = NULL; // Set to NULL to continue tokenizing the buffer
         }
     }
+}
+
+// Reads binary records - the default, no string parsing needed
+static int read_binary(int fd) {
+    struct mouse_event_record records[64];
+    int format = MOUSE_FMT_BINARY;
+
+    if (ioctl(fd, MOUSE_LOGGER_SET_FORMAT, &format) < 0) {
+        perror("Failed to select binary format");
+        return 1;
+    }
+
+    while (1) {
+        ssize_t bytes_read = read(fd, records, sizeof(records));
+        if (bytes_read < 0) {
+            perror("Read failed");
+            return 1;
+        } else if (bytes_read == 0) {
+            printf("No data available, but read returned 0. Is the device non-blocking?\n");
+            return 1;
+        }
+
+        // driver only returns whole records
+        size_t count = bytes_read / sizeof(records[0]);
+        for (size_t i = 0; i < count; i++) print_clicks(&records[i], DEVICE_FILE);
+    }
+}
+
+// Consumes records straight from the mmap'd ring (run with -m) - the only syscall is the
+// MOUSE_LOGGER_WAIT ioctl, made when there is nothing new to read
+static int read_mmap(int fd) {
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    // map the header page first to learn how big the whole ring is
+    struct mouse_ring_header *hdr = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        perror("Failed to map ring header");
+        return 1;
+    }
+    size_t size = hdr->data_offset + (size_t)hdr->capacity * hdr->slot_size;
+    munmap(hdr, page_size);
+
+    hdr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        perror("Failed to map ring");
+        return 1;
+    }
+    const struct mouse_ring_slot *slots = (const void *)((const char *)hdr + hdr->data_offset);
+    uint64_t mask = hdr->capacity - 1;
+
+    // start with whatever arrives next
+    uint64_t pos = __atomic_load_n(&hdr->data_head, __ATOMIC_ACQUIRE);
+    while (1) {
+        const struct mouse_ring_slot *slot = &slots[pos & mask];
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == pos + 1) {
+            struct mouse_event_record rec = slot->rec;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            // seq still matches, so the copy wasn't torn by a producer wrapping around
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == pos + 1) {
+                print_clicks(&rec, "mmap");
+                pos++;
+                continue;
+            }
+        }
+
+        uint64_t head = __atomic_load_n(&hdr->data_head, __ATOMIC_ACQUIRE);
+        if (head - pos > hdr->capacity) {
+            fprintf(stderr, "Fell behind, skipped %llu events\n", (unsigned long long)(head - hdr->capacity - pos));
+            pos = head - hdr->capacity;
+            continue;
+        }
+
+        // caught up - sleep in the driver until pos is written
+        if (ioctl(fd, MOUSE_LOGGER_WAIT, &pos) < 0) {
+            perror("Wait failed");
+            munmap(hdr, size);
+            return 1;
+        }
+    }
+}
+
+// Batched consumer (run with -c) - big reads, records parsed in place, output written in big chunks
+#define CONSUME_READ_SIZE (1 << 20)
+#define CONSUME_OUT_SIZE (1 << 20)
+#define CONSUME_LINE_MAX 256 // longest text/CSV output of one record
+
+enum { OUT_TEXT, OUT_CSV, OUT_BINARY, OUT_COMPACT };
+
+// Delta state of a MOUSE_FMT_COMPACT stream, same as the driver's encoder keeps
+struct compact_state {
+    uint64_t timestamp_ns;
+    uint16_t device_id;
+    uint16_t buttons;
+};
+
+// Reads one LEB128 varint, returns the bytes it used or 0 if it runs past len
+static size_t get_varint(const uint8_t *p, size_t len, uint64_t *v) {
+    *v = 0;
+    for (size_t i = 0; i < len && i < 10; i++) {
+        *v |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) return i + 1;
+    }
+    return 0;
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// Decodes one MOUSE_FMT_COMPACT record (see mouse_logger.h) back into a full record.
+// Returns the bytes used, or 0 if the record continues past len - the state is then untouched.
+static size_t compact_decode(struct compact_state *st, const uint8_t *buf, size_t len, struct mouse_event_record *rec) {
+    uint64_t v;
+    size_t off = 1, n;
+
+#define NEXT_VARINT() do { n = get_varint(buf + off, len - off, &v); if (!n) return 0; off += n; } while (0)
+
+    if (!len) return 0;
+    uint8_t flags = buf[0];
+
+    memset(rec, 0, sizeof(*rec));
+    rec->type = EV_SYN;
+    rec->code = SYN_REPORT;
+    rec->device_id = st->device_id;
+    rec->buttons = st->buttons;
+
+    NEXT_VARINT();
+    rec->timestamp_ns = st->timestamp_ns + unzigzag(v);
+    if (flags & MOUSE_COMPACT_DEVICE) {
+        NEXT_VARINT();
+        rec->device_id = v;
+    }
+    if (flags & MOUSE_COMPACT_MOTION) {
+        NEXT_VARINT();
+        rec->rel_x = unzigzag(v);
+        NEXT_VARINT();
+        rec->rel_y = unzigzag(v);
+    }
+    if (flags & MOUSE_COMPACT_WHEEL) {
+        NEXT_VARINT();
+        rec->wheel = unzigzag(v);
+        NEXT_VARINT();
+        rec->hwheel = unzigzag(v);
+    }
+    if (flags & MOUSE_COMPACT_BUTTONS) {
+        if (off + 1 > len) return 0;
+        rec->buttons = buf[off++];
+    }
+    if (flags & MOUSE_COMPACT_CHANGES) {
+        if (off + 2 > len) return 0;
+        rec->pressed = buf[off++];
+        rec->released = buf[off++];
+    }
+    if (flags & MOUSE_COMPACT_OTHER) {
+        NEXT_VARINT();
+        rec->type = v;
+        NEXT_VARINT();
+        rec->code = v;
+        NEXT_VARINT();
+        rec->value = unzigzag(v);
+    }
+#undef NEXT_VARINT
+
+    st->timestamp_ns = rec->timestamp_ns;
+    st->device_id = rec->device_id;
+    st->buttons = rec->buttons;
+    return off;
+}
+
+struct out_buffer {
+    int fd;
+    char *data;
+    size_t len;
+};
+
+static volatile sig_atomic_t stop_consuming;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_consuming = 1;
+}
+
+static int out_flush(struct out_buffer *out) {
+    size_t done = 0;
+
+    while (done < out->len) {
+        ssize_t n = write(out->fd, out->data + done, out->len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
+    }
+    out->len = 0;
+    return 0;
+}
+
+static void out_str(struct out_buffer *out, const char *str) {
+    size_t n = strlen(str);
+
+    memcpy(out->data + out->len, str, n);
+    out->len += n;
+}
+
+// Appends a decimal number - cheaper than going through printf for every field
+static void out_num(struct out_buffer *out, long long value) {
+    char digits[24];
+    int n = 0;
+    unsigned long long v = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+
+    if (value < 0) out->data[out->len++] = '-';
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n) out->data[out->len++] = digits[--n];
+}
+
+// Same lines the driver renders for text reads
+static void out_text(struct out_buffer *out, const struct mouse_event_record *rec) {
+    static const char *const button_names[] = { "Left", "Right", "Middle", "Side", "Extra", "Forward", "Back", "Task" };
+
+    if (rec->type == EV_SYN && rec->code == SYN_DROPPED) {
+        out_str(out, "Lapped: ");
+        out_num(out, rec->value);
+        out_str(out, " events lost\n");
+        return;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (rec->pressed & (1u << i)) {
+            out_str(out, button_names[i]);
+            out_str(out, " Click\n");
+        }
+    }
+    if (rec->rel_x || rec->rel_y) {
+        out_str(out, "Mouse Move: X=");
+        out_num(out, rec->rel_x);
+        out_str(out, " Y=");
+        out_num(out, rec->rel_y);
+        out_str(out, "\n");
+    }
+    if (rec->wheel || rec->hwheel) {
+        out_str(out, "Wheel: V=");
+        out_num(out, rec->wheel);
+        out_str(out, " H=");
+        out_num(out, rec->hwheel);
+        out_str(out, "\n");
+    }
+}
+
+static void out_csv(struct out_buffer *out, const struct mouse_event_record *rec) {
+    const long long fields[] = {
+        (long long)rec->timestamp_ns, rec->device_id, rec->buttons, rec->pressed, rec->released,
+        rec->rel_x, rec->rel_y, rec->wheel, rec->hwheel,
+        rec->type == EV_SYN && rec->code == SYN_DROPPED ? rec->value : 0,
+    };
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (i) out->data[out->len++] = ',';
+        out_num(out, fields[i]);
+    }
+    out->data[out->len++] = '\n';
+}
+
+// Appends one record in the output format
+static void out_record(struct out_buffer *out, int format, const struct mouse_event_record *rec) {
+    if (format == OUT_CSV) {
+        out_csv(out, rec);
+    } else if (format == OUT_BINARY) {
+        memcpy(out->data + out->len, rec, sizeof(*rec));
+        out->len += sizeof(*rec);
+    } else {
+        out_text(out, rec);
+    }
+}
+
+// Drains fd into path (or stdout) until interrupted or end of file. in_compact says fd holds
+// MOUSE_FMT_COMPACT data (a capture made with -c compact), otherwise binary records.
+// When the output is the same format as the input, bytes are written straight from the read buffer.
+static int consume(int fd, int in_compact, int format, const char *path) {
+    struct out_buffer out = { .fd = STDOUT_FILENO };
+    struct compact_state st = { 0 };
+    struct mouse_event_record decoded;
+    unsigned long long records = 0, bytes = 0;
+    int raw = in_compact ? format == OUT_COMPACT : format == OUT_BINARY;
+    size_t have = 0; // bytes in buf, a partial record is kept at the front for the next read
+    int ret = 0;
+
+    if (path) {
+        out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out.fd < 0) {
+            perror(path);
+            return 1;
+        }
+    }
+
+    char *buf = aligned_alloc(4096, CONSUME_READ_SIZE);
+    out.data = aligned_alloc(4096, CONSUME_OUT_SIZE);
+    if (!buf || !out.data) {
+        perror("Failed to allocate buffers");
+        return 1;
+    }
+
+    // no SA_RESTART, so Ctrl-C interrupts a blocked read and the tail still gets flushed
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (format == OUT_CSV) out_str(&out, "timestamp_ns,device,buttons,pressed,released,rel_x,rel_y,wheel,hwheel,lost\n");
+
+    while (!stop_consuming) {
+        ssize_t n = read(fd, buf + have, CONSUME_READ_SIZE - have);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Read failed");
+            ret = 1;
+            break;
+        } else if (n == 0) {
+            break; // end of a capture file, or a per device node whose mouse was unplugged
+        }
+        have += n;
+        bytes += n;
+
+        if (raw) {
+            // already in the output format - write it straight from the read buffer
+            struct out_buffer direct = { .fd = out.fd, .data = buf, .len = have };
+            if (out_flush(&direct) < 0) {
+                perror("Write failed");
+                ret = 1;
+                break;
+            }
+            if (!in_compact) records += have / sizeof(struct mouse_event_record);
+            have = 0;
+            continue;
+        }
+
+        size_t used = 0;
+        int failed = 0;
+        while (!failed) {
+            const struct mouse_event_record *rec = (const void *)(buf + used);
+            if (in_compact) {
+                size_t len = compact_decode(&st, (const uint8_t *)buf + used, have - used, &decoded);
+                if (!len) break;
+                used += len;
+                rec = &decoded;
+            } else {
+                if (have - used < sizeof(*rec)) break;
+                used += sizeof(*rec);
+            }
+            if (out.len + CONSUME_LINE_MAX > CONSUME_OUT_SIZE) failed = out_flush(&out) < 0;
+            out_record(&out, format, rec);
+            records++;
+        }
+        // one write per batch read
+        if (failed || out_flush(&out) < 0) {
+            perror("Write failed");
+            ret = 1;
+            break;
+        }
+
+        have -= used;
+        memmove(buf, buf + used, have);
+    }
+
+    if (out_flush(&out) < 0) perror("Write failed");
+    if (have) fprintf(stderr, "Input ended in the middle of a record (%zu bytes left)\n", have);
+    if (records || !in_compact) fprintf(stderr, "Consumed %llu records (%llu bytes)\n", records, bytes);
+    else fprintf(stderr, "Consumed %llu bytes\n", bytes);
+    if (path) close(out.fd);
+    free(out.data);
+    free(buf);
+    return ret;
+}
+
+// Sets up the device for -c: binary records, or compact ones when that is also the output
+static int consume_device(int fd, int format, const char *path) {
+    // ask for the batch to build up a little in the driver, instead of one wakeup per frame
+    struct mouse_wakeup_config wakeup = { .watermark = 256, .timeout_us = 10000 };
+    int device_format = format == OUT_COMPACT ? MOUSE_FMT_COMPACT : MOUSE_FMT_BINARY;
+
+    if (ioctl(fd, MOUSE_LOGGER_SET_FORMAT, &device_format) < 0 || ioctl(fd, MOUSE_LOGGER_SET_WAKEUP, &wakeup) < 0) {
+        perror("Failed to set up the device");
+        return 1;
+    }
+    return consume(fd, format == OUT_COMPACT, format, path);
+}
+
+// Turns a compact capture back into text, CSV or binary records (run with -d file [format])
+static int decode_file(const char *capture, int format) {
+    int fd = open(capture, O_RDONLY);
+    int ret;
+
+    if (fd < 0) {
+        perror(capture);
+        return 1;
+    }
+    ret = consume(fd, 1, format, NULL);
+    close(fd);
+    return ret;
+}
+
+static int parse_format(const char *name) {
+    if (strcmp(name, "text") == 0) return OUT_TEXT;
+    if (strcmp(name, "csv") == 0) return OUT_CSV;
+    if (strcmp(name, "binary") == 0) return OUT_BINARY;
+    if (strcmp(name, "compact") == 0) return OUT_COMPACT;
+    fprintf(stderr, "Unknown output format %s (text, csv, binary or compact)\n", name);
+    return -1;
+}
+
+// Copies one entry of the state page, retrying while the driver is updating it
+static void read_device_state(const struct mouse_device_state *shared, struct mouse_device_state *copy) {
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+        *copy = *shared;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&shared->seq, __ATOMIC_RELAXED) != seq);
+}
+
+// Shows where each mouse is and what it holds (run with -p) - reads the mmap'd state page,
+// so each refresh is a few memory loads and no syscalls
+static int watch_state(int fd) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    const struct mouse_state_page *page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, (off_t)MOUSE_STATE_PGOFF * page_size);
+
+    if (page == MAP_FAILED) {
+        perror("Failed to map state page");
+        return 1;
+    }
+
+    while (1) {
+        struct mouse_device_state st;
+
+        for (uint32_t i = 0; i < page->count; i++) {
+            read_device_state(&page->dev[i], &st);
+            if (!st.connected) continue;
+            printf("%s %u: X=%lld Y=%lld buttons=%#x  ", i ? "device" : "all", i, (long long)st.x, (long long)st.y, st.buttons);
+        }
+        printf("\r");
+        fflush(stdout);
+        usleep(100000);
+    }
+}
+
+// Watches several logger devices from one thread with epoll (run with -e dev...)
+static int read_epoll(int argc, char *argv[]) {
+    struct mouse_event_record records[64];
+    struct epoll_event events[16];
+    int format = MOUSE_FMT_BINARY;
+    int epfd = epoll_create1(0);
+
+    if (epfd < 0) {
+        perror("epoll_create1 failed");
+        return 1;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        // non-blocking so each wakeup drains a device until EAGAIN without stalling the others
+        int fd = open(argv[i], O_RDONLY | O_NONBLOCK);
+        if (fd < 0 || ioctl(fd, MOUSE_LOGGER_SET_FORMAT, &format) < 0 || set_click_filter(fd) < 0) {
+            perror(argv[i]);
+            return 1;
+        }
+        struct epoll_event ev = { .events = EPOLLIN };
+        ev.data.u64 = ((uint64_t)fd << 32) | i; // fd and index into argv
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl failed");
+            return 1;
+        }
+    }
+
+    printf("Listening for mouse clicks on %d devices...\n", argc);
+
+    while (1) {
+        int n = epoll_wait(epfd, events, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            return 1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.u64 >> 32;
+            const char *path = argv[events[i].data.u64 & 0xffffffff];
+
+            ssize_t bytes_read;
+            while ((bytes_read = read(fd, records, sizeof(records))) > 0) {
+                size_t count = bytes_read / sizeof(records[0]);
+                for (size_t j = 0; j < count; j++) print_clicks(&records[j], path);
+            }
+            if (bytes_read == 0) {
+                // end of file - the mouse behind a per device node was unplugged
+                printf("%s disconnected\n", path);
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                close(fd);
+            } else if (errno != EAGAIN) {
+                perror(path);
+                return 1;
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2 && strcmp(argv[1], "-e") == 0) return read_epoll(argc - 2, argv + 2);
+
+    int text_mode = argc > 1 && strcmp(argv[1], "-t") == 0;
+    int mmap_mode = argc > 1 && strcmp(argv[1], "-m") == 0;
+    int consume_mode = argc > 1 && strcmp(argv[1], "-c") == 0; // -c [text|csv|binary|compact] [file]
+    int decode_mode = argc > 2 && strcmp(argv[1], "-d") == 0;  // -d capture [text|csv|binary]
+    const char *format_name = consume_mode && argc > 2 ? argv[2] : decode_mode && argc > 3 ? argv[3] : "text";
+    int out_format = parse_format(format_name);
+
+    if (out_format < 0) return 1;
+    if (decode_mode) return decode_file(argv[2], out_format);
+
+    int state_mode = argc > 1 && strcmp(argv[1], "-p") == 0;
+    int version = 0;
+    int fd = open(DEVICE_FILE, O_RDONLY); // Open the device file in read only mode
+
+    // Check if the device file was opened successfully
+    if (fd < 0) {
+        perror("Failed to open device file");
+        return 1;
+    }
+
+    // make sure the driver speaks the same record format as this build
+    if (ioctl(fd, MOUSE_LOGGER_GET_VERSION, &version) < 0 || version != MOUSE_LOGGER_ABI_VERSION) {
+        fprintf(stderr, "Driver ABI version %d does not match userapp (%d)\n", version, MOUSE_LOGGER_ABI_VERSION);
+        close(fd);
+        return 1;
+    }
+
+    if (state_mode) {
+        int ret = watch_state(fd);
+        close(fd);
+        return ret;
+    }
+
+    // use ioctl command to clear the buffer before reading new events
+    if (ioctl(fd, MOUSE_LOGGER_CLEAR) < 0) {
+        perror("Failed to clear buffer");
+        close(fd);
+        return 1;
+    }
+
+    if (consume_mode) {
+        int ret = consume_device(fd, out_format, argc > 3 ? argv[3] : NULL); // every event, not just clicks
+        close(fd);
+        return ret;
+    }
+
+    // filters mouse inputs to only include clicks in userapp - avoid clogging terminal
+    // (the mmap'd ring is shared by everyone, so -m still checks each record itself)
+    if (!mmap_mode && set_click_filter(fd) < 0) {
+        perror("Failed to set click filter");
+        close(fd);
+        return 1;
+    }
+
+    printf("Listening for mouse clicks...\n");
+
+    int ret;
+    if (text_mode) ret = read_text(fd);
+    else if (mmap_mode) ret = read_mmap(fd);
+    else ret = read_binary(fd);
 
     // Close the device file before exiting
     close(fd);
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
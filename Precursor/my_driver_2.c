@@ -4,32 +4,75 @@
 #include <linux/uaccess.h>
 #include <linux/wait.h>
 #include <linux/ioctl.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+#include <linux/scatterlist.h>
 
 #define DEVICE_NAME "my_char_device"
-#define BUFFER_SIZE 1024
+#define BUFFER_SIZE 1024 // largest write that is guaranteed to go in whole
+#define MAX_CHANNELS 256 // register_chrdev gives us minors 0-255
 
 #define MY_IOCTL_MAGIC 'M'
 #define IOCTL_GET_STATS _IOR(MY_IOCTL_MAGIC, 1, struct device_stats)
+#define IOCTL_SET_FRAMING _IOW(MY_IOCTL_MAGIC, 2, int)  // 1 = framed records, 0 = byte stream
 
 struct device_stats {
     int read_count;
     int write_count;
 };
 
-static struct device_stats stats = {0, 0};  // Initialize read/write counts to 0
+// How many bytes writers can run ahead of readers (rounded up to a power of two)
+static unsigned int fifo_depth = 16 * BUFFER_SIZE;
+module_param(fifo_depth, uint, 0444);
+MODULE_PARM_DESC(fifo_depth, "Bytes buffered between writers and readers of a channel (default 16384)");
 
+// Each minor number is its own channel, /dev/my_char_device<N> for minor N
+static unsigned int nr_channels = 4;
+module_param_named(channels, nr_channels, uint, 0444);
+MODULE_PARM_DESC(channels, "Number of independent channels, one per minor (default 4, max 256)");
+
+// In framed mode a channel carries records instead of bytes. Each record is a u32 length in native
+// byte order followed by that many payload bytes - writers write them in that format and readers get
+// them back the same way, as many whole records as fit in the read. Record boundaries are kept,
+// so one readv/writev or io_uring request can move a whole batch of messages.
+#define RECORD_HEADER sizeof(u32)
+
+// One independent FIFO between writers and readers. kfifo is safe with one reader and one writer
+// running at the same time, so readers only serialize on read_lock and writers on write_lock -
+// a reader never waits for a writer's lock or the other way round. The reader and writer halves
+// sit on their own cache lines so the two sides don't keep stealing them from each other.
+struct my_channel {
+    struct kfifo fifo;
+    DECLARE_KFIFO_PTR(lengths, u32); // payload length of each record in the FIFO, framed mode only
+    bool framed;                     // only changes while the channel is empty, under both locks
+
+    struct mutex read_lock ____cacheline_aligned_in_smp;
+    wait_queue_head_t read_queue;  // readers sleep here while the FIFO is empty
+    int read_count;                // protected by read_lock
+
+    struct mutex write_lock ____cacheline_aligned_in_smp;
+    wait_queue_head_t write_queue; // writers sleep here while it is too full
+    int write_count;               // protected by write_lock
+};
 
 static int major_number;
-static char device_buffer[BUFFER_SIZE];
-static int buffer_size = 0;
-static wait_queue_head_t queue;
+static struct my_channel *channels;
 static struct file_operations fops;
 
 // Function prototypes
 static int my_open(struct inode *inode, struct file *file);
 static int my_close(struct inode *inode, struct file *file);
-static ssize_t my_read(struct file *file, char __user *user_buf, size_t size, loff_t *offset);
-static ssize_t my_write(struct file *file, const char __user *user_buf, size_t size, loff_t *offset);
+static ssize_t my_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t my_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static __poll_t my_poll(struct file *file, poll_table *wait);
+static ssize_t my_splice_read(struct file *file, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+static ssize_t my_splice_write(struct pipe_inode_info *pipe, struct file *file, loff_t *ppos, size_t len, unsigned int flags);
 static long my_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 
 
@@ -38,14 +81,21 @@ static struct file_operations fops = {
     .owner = THIS_MODULE,
     .open = my_open,
     .release = my_close,
-    .read = my_read,
-    .write = my_write,
+    .read_iter = my_read_iter,   // plain read()/write() come through these too
+    .write_iter = my_write_iter,
+    .poll = my_poll,
+    .splice_read = my_splice_read,
+    .splice_write = my_splice_write,
     .unlocked_ioctl = my_ioctl,
 };
 
-// Open function
+// Open function - the minor number picks the channel
 static int my_open(struct inode *inode, struct file *file) {
-    printk(KERN_INFO "Device opened\n");
+    unsigned int minor = iminor(inode);
+
+    if (minor >= nr_channels) return -ENXIO;
+    file->private_data = &channels[minor];
+    printk(KERN_INFO "Device opened (channel %u)\n", minor);
     return 0;
 }
 
@@ -55,72 +105,403 @@ static int my_close(struct inode *inode, struct file *file) {
     return 0;
 }
 
-// Read function
-static ssize_t my_read(struct file *file, char __user *user_buf, size_t size, loff_t *offset) {
-    if (buffer_size == 0) {
-        wait_event_interruptible(queue, buffer_size > 0);
+// Space a write of size bytes waits for - writes up to BUFFER_SIZE go in whole, like a pipe,
+// so messages from different writers never get mixed up; bigger ones go in as space frees up
+static unsigned int write_room_needed(struct my_channel *ch, size_t size) {
+    return min_t(size_t, size, min_t(size_t, BUFFER_SIZE, kfifo_size(&ch->fifo)));
+}
+
+// True when a reader would get something - any byte, or in framed mode a whole record
+static bool readable(struct my_channel *ch) {
+    return ch->framed ? !kfifo_is_empty(&ch->lengths) : !kfifo_is_empty(&ch->fifo);
+}
+
+// True when a record with a len byte payload fits (framed mode)
+static bool record_fits(struct my_channel *ch, size_t len) {
+    return !kfifo_is_full(&ch->lengths) && kfifo_avail(&ch->fifo) >= len;
+}
+
+// True when a writer waiting for need bytes of room can go again
+static bool writable(struct my_channel *ch, size_t need) {
+    return ch->framed ? record_fits(ch, need) : kfifo_avail(&ch->fifo) >= need;
+}
+
+// Waits until the FIFO has data and returns with read_lock held
+static int lock_for_read(struct my_channel *ch, struct file *file, bool nonblock) {
+    if (mutex_lock_interruptible(&ch->read_lock)) return -ERESTARTSYS;
+
+    while (!readable(ch)) {
+        mutex_unlock(&ch->read_lock);
+        if (nonblock || (file->f_flags & O_NONBLOCK)) return -EAGAIN;
+        if (wait_event_interruptible(ch->read_queue, readable(ch))) return -ERESTARTSYS;
+        if (mutex_lock_interruptible(&ch->read_lock)) return -ERESTARTSYS;
+    }
+    return 0;
+}
+
+// Copies up to len bytes from the head of the FIFO into to and consumes them. With whole set
+// it is all or nothing - a fault part way leaves the FIFO as it was and returns 0.
+// The DMA helpers are only used to get the (at most two) linear pieces of the ring.
+static size_t fifo_to_iter(struct kfifo *fifo, struct iov_iter *to, size_t len, bool whole) {
+    struct scatterlist sg[2];
+    unsigned int i, nents;
+    size_t copied = 0;
+
+    sg_init_table(sg, 2);
+    nents = kfifo_dma_out_prepare(fifo, sg, 2, len);
+    for (i = 0; i < nents; i++) {
+        size_t n = copy_to_iter(sg_virt(&sg[i]), sg[i].length, to);
+
+        copied += n;
+        if (n < sg[i].length) break; // fault in the user buffer
+    }
+    if (whole && copied < len) return 0;
+
+    smp_mb(); // done reading before the space goes back to writers
+    kfifo_dma_out_finish(fifo, copied);
+    return copied;
+}
+
+// Copies up to len bytes from from into the FIFO and publishes them to readers, all or nothing
+// with whole set (a fault part way stores nothing and puts from back where it was)
+static size_t fifo_from_iter(struct kfifo *fifo, struct iov_iter *from, size_t len, bool whole) {
+    struct scatterlist sg[2];
+    unsigned int i, nents;
+    size_t copied = 0;
+
+    sg_init_table(sg, 2);
+    nents = kfifo_dma_in_prepare(fifo, sg, 2, len);
+    for (i = 0; i < nents; i++) {
+        size_t n = copy_from_iter(sg_virt(&sg[i]), sg[i].length, from);
+
+        copied += n;
+        if (n < sg[i].length) break; // fault in the user buffer
+    }
+    if (whole && copied < len) {
+        iov_iter_revert(from, copied);
+        return 0;
+    }
+
+    smp_wmb(); // data before the new length is seen by readers
+    kfifo_dma_in_finish(fifo, copied);
+    return copied;
+}
+
+// Byte stream read - whatever is buffered, up to the size of the read
+static ssize_t read_bytes(struct my_channel *ch, struct iov_iter *to) {
+    size_t copied = fifo_to_iter(&ch->fifo, to, iov_iter_count(to), false);
+
+    return copied ? copied : -EFAULT;
+}
+
+// Framed read - as many whole records as fit, each with its length in front
+static ssize_t read_records(struct my_channel *ch, struct iov_iter *to) {
+    ssize_t total = 0;
+    u32 len;
+
+    while (kfifo_peek(&ch->lengths, &len)) {
+        if (iov_iter_count(to) < RECORD_HEADER + len) break;
+        smp_rmb(); // the payload was stored before its length
+
+        if (copy_to_iter(&len, RECORD_HEADER, to) != RECORD_HEADER ||
+            fifo_to_iter(&ch->fifo, to, len, true) != len)
+            return total ? total : -EFAULT;
+        kfifo_skip(&ch->lengths);
+        total += RECORD_HEADER + len;
+    }
+    return total ? total : -EMSGSIZE; // the next record is bigger than the whole read
+}
+
+// Read function - byte stream or whole records depending on the channel mode
+static ssize_t my_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct file *file = iocb->ki_filp;
+    struct my_channel *ch = file->private_data;
+    ssize_t ret;
+
+    if (!iov_iter_count(to)) return 0;
+    ret = lock_for_read(ch, file, iocb->ki_flags & IOCB_NOWAIT);
+    if (ret) return ret;
+
+    ret = ch->framed ? read_records(ch, to) : read_bytes(ch, to);
+    if (ret > 0) ch->read_count++;  // Increment read count
+    mutex_unlock(&ch->read_lock);
+
+    if (ret > 0) wake_up_interruptible(&ch->write_queue); // room for writers
+    return ret;
+}
+
+// Byte stream write - stores what fits, or -EAGAIN with the room to wait for in *need
+static ssize_t write_bytes(struct my_channel *ch, struct iov_iter *from, size_t *need) {
+    size_t copied;
+
+    *need = write_room_needed(ch, iov_iter_count(from));
+    if (kfifo_avail(&ch->fifo) < *need) return -EAGAIN;
+
+    copied = fifo_from_iter(&ch->fifo, from, iov_iter_count(from), false);
+    return copied ? copied : -EFAULT;
+}
+
+// Framed write - stores whole records while they fit, or -EAGAIN with the payload size of the
+// first record in *need. Records bigger than the FIFO or cut short by the end of the write are -EINVAL.
+static ssize_t write_records(struct my_channel *ch, struct iov_iter *from, size_t *need) {
+    ssize_t total = 0;
+    ssize_t ret = 0;
+
+    while (iov_iter_count(from)) {
+        size_t n;
+        u32 len;
+
+        if (iov_iter_count(from) < RECORD_HEADER) {
+            ret = -EINVAL;
+            break;
+        }
+        n = copy_from_iter(&len, RECORD_HEADER, from);
+        if (n != RECORD_HEADER) {
+            iov_iter_revert(from, n);
+            ret = -EFAULT;
+            break;
+        }
+        if (len > kfifo_size(&ch->fifo) || len > iov_iter_count(from)) {
+            iov_iter_revert(from, RECORD_HEADER);
+            ret = -EINVAL;
+            break;
+        }
+        if (!record_fits(ch, len)) {
+            iov_iter_revert(from, RECORD_HEADER);
+            *need = len;
+            ret = -EAGAIN;
+            break;
+        }
+        if (fifo_from_iter(&ch->fifo, from, len, true) != len) {
+            iov_iter_revert(from, RECORD_HEADER);
+            ret = -EFAULT;
+            break;
+        }
+        kfifo_put(&ch->lengths, len); // publishes the record
+        total += RECORD_HEADER + len;
+    }
+    return total ? total : ret;
+}
+
+// Write function - blocks until at least something could be stored
+static ssize_t my_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct file *file = iocb->ki_filp;
+    struct my_channel *ch = file->private_data;
+    size_t need = 0;
+    ssize_t ret;
+
+    if (!iov_iter_count(from)) return 0;
+
+    while (1) {
+        if (mutex_lock_interruptible(&ch->write_lock)) return -ERESTARTSYS;
+        ret = ch->framed ? write_records(ch, from, &need) : write_bytes(ch, from, &need);
+        if (ret > 0) ch->write_count++;  // Increment write count
+        mutex_unlock(&ch->write_lock);
+        if (ret != -EAGAIN) break;
+
+        if ((iocb->ki_flags & IOCB_NOWAIT) || (file->f_flags & O_NONBLOCK)) return -EAGAIN;
+        if (wait_event_interruptible(ch->write_queue, writable(ch, need))) return -ERESTARTSYS;
     }
 
-    size = min(size, (size_t)buffer_size);
-    if (copy_to_user(user_buf, device_buffer, size)) {
-        return -EFAULT;
+    if (ret > 0) wake_up_interruptible(&ch->read_queue); // data for readers
+    return ret;
+}
+
+// Pages we hand to a pipe are plain kernel pages, the pipe frees them once they are consumed
+static const struct pipe_buf_operations fifo_pipe_buf_ops = {
+    .release = generic_pipe_buf_release,
+    .try_steal = generic_pipe_buf_try_steal,
+    .get = generic_pipe_buf_get,
+};
+
+// splice()/sendfile() out of the device - FIFO data is moved into fresh pages that go straight
+// into the pipe, so it never passes through a user space buffer
+static ssize_t my_splice_read(struct file *file, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags) {
+    struct my_channel *ch = file->private_data;
+    ssize_t total = 0;
+    ssize_t ret;
+
+    if (!len) return 0;
+    ret = lock_for_read(ch, file, flags & SPLICE_F_NONBLOCK);
+    if (ret) return ret;
+    if (ch->framed) {
+        mutex_unlock(&ch->read_lock);
+        return -EINVAL; // a pipe can't keep record boundaries
     }
 
-    buffer_size = 0;
-    stats.read_count++;  // Increment read count
+    while (len && !kfifo_is_empty(&ch->fifo) && !pipe_full(pipe->head, pipe->tail, pipe->max_usage)) {
+        struct pipe_buffer buf = { .ops = &fifo_pipe_buf_ops };
+
+        if (!pipe->readers) { // nobody to hand the data to, leave it for other readers
+            send_sig(SIGPIPE, current, 0);
+            ret = -EPIPE;
+            break;
+        }
+        buf.page = alloc_page(GFP_KERNEL);
+        if (!buf.page) {
+            ret = -ENOMEM;
+            break;
+        }
+        // only peek - the bytes stay in the FIFO until the pipe has taken them, so nothing is
+        // lost when add_to_pipe fails with -EPIPE (it drops the page and sends SIGPIPE itself)
+        buf.len = kfifo_out_peek(&ch->fifo, page_address(buf.page), min_t(size_t, len, PAGE_SIZE));
 
-    return size;
+        ret = add_to_pipe(pipe, &buf);
+        if (ret < 0) break;
+        smp_mb(); // done reading before the space goes back to writers
+        kfifo_dma_out_finish(&ch->fifo, ret); // consume what went into the pipe
+        total += ret;
+        len -= ret;
+    }
+    if (total) ch->read_count++;
+    mutex_unlock(&ch->read_lock);
+
+    if (total) wake_up_interruptible(&ch->write_queue);
+    return total ? total : ret;
 }
 
-// Write function (blocks if buffer is full)
-static ssize_t my_write(struct file *file, const char __user *user_buf, size_t size, loff_t *offset) {
-    if (buffer_size > 0) {
-        wait_event_interruptible(queue, buffer_size == 0);
+// Copies one pipe buffer into the FIFO, waiting for room only if nothing went in yet
+static int fifo_from_pipe_buf(struct pipe_inode_info *pipe, struct pipe_buffer *buf, struct splice_desc *sd) {
+    struct file *file = sd->u.file;
+    struct my_channel *ch = file->private_data;
+    unsigned int copied;
+    void *data;
+
+    if (kfifo_is_full(&ch->fifo)) {
+        if (sd->num_spliced) return 0; // hand back what we have, like a short write
+        if ((sd->flags & SPLICE_F_NONBLOCK) || (file->f_flags & O_NONBLOCK)) return -EAGAIN;
+        if (wait_event_interruptible(ch->write_queue, !kfifo_is_full(&ch->fifo))) return -ERESTARTSYS;
     }
 
-    size = min(size, (size_t)BUFFER_SIZE);
-    if (copy_from_user(device_buffer, user_buf, size)) {
-        return -EFAULT;
+    data = kmap_local_page(buf->page);
+    copied = kfifo_in(&ch->fifo, data + buf->offset, sd->len);
+    kunmap_local(data);
+
+    wake_up_interruptible(&ch->read_queue);
+    return copied;
+}
+
+// splice()/sendfile() into the device - copies straight from the pipe's pages into the FIFO
+static ssize_t my_splice_write(struct pipe_inode_info *pipe, struct file *file, loff_t *ppos, size_t len, unsigned int flags) {
+    struct my_channel *ch = file->private_data;
+    ssize_t ret;
+
+    if (mutex_lock_interruptible(&ch->write_lock)) return -ERESTARTSYS;
+    if (ch->framed) {
+        mutex_unlock(&ch->write_lock);
+        return -EINVAL;
     }
+    ret = splice_from_pipe(pipe, file, ppos, len, flags, fifo_from_pipe_buf);
+    if (ret > 0) ch->write_count++;
+    mutex_unlock(&ch->write_lock);
+    return ret;
+}
 
-    buffer_size = size;
-    wake_up_interruptible(&queue);
-    stats.write_count++;  // Increment write count
+// Poll function - readable while a read would return something, writable while a small write would fit
+static __poll_t my_poll(struct file *file, poll_table *wait) {
+    struct my_channel *ch = file->private_data;
+    __poll_t mask = 0;
 
-    return size;
+    poll_wait(file, &ch->read_queue, wait);
+    poll_wait(file, &ch->write_queue, wait);
+    if (readable(ch)) mask |= EPOLLIN | EPOLLRDNORM;
+    if (writable(ch, write_room_needed(ch, BUFFER_SIZE))) mask |= EPOLLOUT | EPOLLWRNORM;
+    return mask;
 }
 
-// IOCTL function
+// IOCTL function - stats are for the channel this file was opened on
 static long my_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    struct my_channel *ch = file->private_data;
+    struct device_stats stats;
+    int framed;
+    long ret = 0;
+
     switch (cmd) {
         case IOCTL_GET_STATS:
+            stats.read_count = READ_ONCE(ch->read_count);
+            stats.write_count = READ_ONCE(ch->write_count);
             if (copy_to_user((struct device_stats __user *)arg, &stats, sizeof(stats)))
                 return -EFAULT;
             break;
 
+        case IOCTL_SET_FRAMING:
+            if (get_user(framed, (int __user *)arg)) return -EFAULT;
+
+            // Only switch while nothing is buffered, with both sides locked out
+            mutex_lock(&ch->write_lock);
+            mutex_lock(&ch->read_lock);
+            if (kfifo_is_empty(&ch->fifo) && kfifo_is_empty(&ch->lengths))
+                ch->framed = framed;
+            else
+                ret = -EBUSY;
+            mutex_unlock(&ch->read_lock);
+            mutex_unlock(&ch->write_lock);
+
+            // waiters recheck their condition in the new mode
+            wake_up_interruptible(&ch->read_queue);
+            wake_up_interruptible(&ch->write_queue);
+            break;
+
         default:
             return -EINVAL;  // Invalid IOCTL command
     }
-    return 0;
+    return ret;
 }
 
 
+static void free_channels(unsigned int count) {
+    while (count--) {
+        kfifo_free(&channels[count].fifo);
+        kfifo_free(&channels[count].lengths);
+    }
+    kfree(channels);
+}
+
 // Module initialization
 static int __init my_init(void) {
+    unsigned int i;
+    int ret;
+
+    if (nr_channels < 1 || nr_channels > MAX_CHANNELS) {
+        printk(KERN_ALERT "channels must be between 1 and %d\n", MAX_CHANNELS);
+        return -EINVAL;
+    }
+
+    channels = kcalloc(nr_channels, sizeof(*channels), GFP_KERNEL);
+    if (!channels) return -ENOMEM;
+
+    for (i = 0; i < nr_channels; i++) {
+        struct my_channel *ch = &channels[i];
+
+        ret = kfifo_alloc(&ch->fifo, max(fifo_depth, (unsigned int)BUFFER_SIZE), GFP_KERNEL);
+        // room for one record per 8 bytes of FIFO, so small records aren't held back by the count
+        if (!ret) ret = kfifo_alloc(&ch->lengths, kfifo_size(&ch->fifo) / 8, GFP_KERNEL);
+        if (ret) {
+            free_channels(i + 1); // kfifo_free is fine on the one that wasn't allocated
+            return ret;
+        }
+        mutex_init(&ch->read_lock);
+        mutex_init(&ch->write_lock);
+        init_waitqueue_head(&ch->read_queue);
+        init_waitqueue_head(&ch->write_queue);
+    }
+
     major_number = register_chrdev(0, DEVICE_NAME, &fops);
     if (major_number < 0) {
         printk(KERN_ALERT "Failed to register character device\n");
+        free_channels(nr_channels);
         return major_number;
     }
 
-    init_waitqueue_head(&queue);
-    printk(KERN_INFO "Registered device with major number %d\n", major_number);
+    printk(KERN_INFO "Registered device with major number %d, %u channels with %u byte FIFOs\n",
+           major_number, nr_channels, kfifo_size(&channels[0].fifo));
     return 0;
 }
 
 // Module exit
 static void __exit my_exit(void) {
     unregister_chrdev(major_number, DEVICE_NAME);
+    free_channels(nr_channels);
     printk(KERN_INFO "Device unregistered\n");
 }
 
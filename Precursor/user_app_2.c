@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -6,11 +7,22 @@
 #include <sys/ioctl.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
 
 #define DEVICE_PATH "/dev/my_char_device"
 #define MY_IOCTL_MAGIC 'M'
 #define IOCTL_GET_STATS _IOR('M', 1, struct device_stats)
+#define IOCTL_SET_FRAMING _IOW('M', 2, int)
 #define BUFFER_SIZE 1024
+#define CHUNK_SIZE (64 * 1024) // bytes moved per call in the transfer modes
+#define MAX_CHANNELS 256
 
 struct device_stats {
       int read_count;
@@ -32,7 +44,7 @@ void *reader_thread(void *arg) {
 
     char buffer[BUFFER_SIZE];
     while (running) {
-        ssize_t bytes_read = read(fd, buffer, BUFFER_SIZE);
+        ssize_t bytes_read = read(fd, buffer, BUFFER_SIZE - 1);  // leave room for the '\0'
         if (bytes_read > 0) {
             buffer[bytes_read] = '\0';  // Null-terminate the buffer
             printf("Read from device: %s\n", buffer);
@@ -68,10 +80,531 @@ void *writer_thread(void *arg) {
     return NULL;
 }
 
-int main() {
+// Transfer modes: push size bytes from a memory file through the device into /dev/null
+// and time it, either with read()/write() through a user buffer or with sendfile()/splice()
+struct transfer {
+    int splice;    // 1 = sendfile()/splice(), 0 = read()/write()
+    size_t size;
+    int source;    // memfd holding the data to send
+    char device[64];
+};
+
+// Channel 0 is /dev/my_char_device, channel N is /dev/my_char_deviceN
+static void channel_path(char *path, size_t size, int channel) {
+    if (channel) snprintf(path, size, "%s%d", DEVICE_PATH, channel);
+    else snprintf(path, size, "%s", DEVICE_PATH);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void *transfer_writer(void *arg) {
+    struct transfer *t = arg;
+    static char buffer[CHUNK_SIZE];
+    int fd = open(t->device, O_WRONLY);
+    off_t offset = 0;
+
+    if (fd < 0) {
+        perror(t->device);
+        exit(1);
+    }
+
+    while ((size_t)offset < t->size) {
+        size_t chunk = t->size - offset < CHUNK_SIZE ? t->size - offset : CHUNK_SIZE;
+        ssize_t sent;
+
+        if (t->splice) {
+            sent = sendfile(fd, t->source, &offset, chunk);  // advances offset itself
+        } else {
+            sent = pread(t->source, buffer, chunk, offset);
+            if (sent > 0) sent = write(fd, buffer, sent);
+            if (sent > 0) offset += sent;
+        }
+        if (sent <= 0) {
+            perror("Failed to write to device");
+            exit(1);
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+void *transfer_reader(void *arg) {
+    struct transfer *t = arg;
+    static char buffer[CHUNK_SIZE];
+    int fd = open(t->device, O_RDONLY);
+    int null_fd = open("/dev/null", O_WRONLY);
+    int pipe_fds[2];
+    size_t done = 0;
+
+    if (fd < 0 || null_fd < 0 || pipe(pipe_fds) < 0) {
+        perror(t->device);
+        exit(1);
+    }
+
+    while (done < t->size) {
+        ssize_t got;
+
+        if (t->splice) {
+            // device -> pipe -> /dev/null, the data stays in kernel pages the whole way
+            got = splice(fd, NULL, pipe_fds[1], NULL, CHUNK_SIZE, SPLICE_F_MOVE);
+            for (ssize_t left = got; left > 0; ) {
+                ssize_t n = splice(pipe_fds[0], NULL, null_fd, NULL, left, SPLICE_F_MOVE);
+
+                if (n <= 0) {
+                    perror("Failed to drain pipe");
+                    exit(1);
+                }
+                left -= n;
+            }
+        } else {
+            got = read(fd, buffer, CHUNK_SIZE);
+            if (got > 0 && write(null_fd, buffer, got) != got) got = -1;
+        }
+        if (got <= 0) {
+            perror("Failed to read from device");
+            exit(1);
+        }
+        done += got;
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    close(null_fd);
+    close(fd);
+    return NULL;
+}
+
+// Runs one reader/writer pair per channel at the same time, each moving megabytes
+int run_transfer(int splice_mode, size_t megabytes, int nchannels) {
+    static struct transfer t[MAX_CHANNELS];
+    pthread_t readers[MAX_CHANNELS], writers[MAX_CHANNELS];
+    size_t size = megabytes << 20;
+    int source;
+    char *data;
+
+    // The source lives in a memory file so reading it costs no disk time
+    source = memfd_create("user_app_2", 0);
+    if (source < 0 || ftruncate(source, size) < 0) {
+        perror("Failed to create source file");
+        return -1;
+    }
+    data = mmap(NULL, size, PROT_WRITE, MAP_SHARED, source, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    memset(data, 'x', size);  // fault the pages in before timing
+    munmap(data, size);
+
+    for (int i = 0; i < nchannels; i++) {
+        t[i].splice = splice_mode;
+        t[i].size = size;
+        t[i].source = source;  // every writer keeps its own offset into it
+        channel_path(t[i].device, sizeof(t[i].device), i);
+    }
+
+    double start = now_seconds();
+    for (int i = 0; i < nchannels; i++) {
+        pthread_create(&readers[i], NULL, transfer_reader, &t[i]);
+        pthread_create(&writers[i], NULL, transfer_writer, &t[i]);
+    }
+    for (int i = 0; i < nchannels; i++) {
+        pthread_join(writers[i], NULL);
+        pthread_join(readers[i], NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("%s: moved %zu MB over %d channel(s) in %.3f s, %.1f MB/s\n", splice_mode ? "splice" : "copy",
+           megabytes * nchannels, nchannels, elapsed, megabytes * nchannels / elapsed);
+    close(source);
+    return 0;
+}
+
+// Bench mode: N writers and M readers spread over the channels, sending fixed size messages for
+// a set time. Every message carries the time it was sent, so readers measure latency, and the
+// driver's counters are read before and after to check nothing was miscounted.
+#define BENCH_MAX_THREADS 256
+#define BENCH_MAX_BATCH 256
+#define BENCH_READ_SIZE (64 * 1024)
+#define BENCH_MAX_SAMPLES (1 << 22) // latency samples kept per reader
+
+struct bench_msg {
+    uint64_t send_ns;  // CLOCK_MONOTONIC just before the write() it went out in
+    uint32_t writer;
+    uint32_t seq;
+};
+
+struct bench_config {
+    int writers, readers, channels;
+    size_t size;   // payload bytes per message
+    int batch;     // messages per write()
+    int seconds;
+    int pin;       // pin every thread to its own CPU
+    int framed;    // use the driver's record framing instead of the byte stream
+};
+
+struct bench_thread {
+    pthread_t thread;
+    struct bench_config *cfg;
+    int index;
+    int cpu;       // -1 = not pinned
+    char device[64];
+    uint64_t messages, bytes, calls, errors;
+    uint64_t *latency;
+    size_t latency_count, latency_size;
+};
+
+static volatile int bench_stop;         // writers stop sending
+static volatile int bench_writers_done; // readers stop once their channel is empty
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+
+    if (cpu < 0) return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        fprintf(stderr, "Failed to pin to CPU %d\n", cpu);
+}
+
+// Bytes one message takes on the wire - framed messages have their length in front
+static size_t bench_record_size(const struct bench_config *cfg) {
+    return (cfg->framed ? sizeof(uint32_t) : 0) + cfg->size;
+}
+
+static void add_latency(struct bench_thread *t, uint64_t ns) {
+    if (t->latency_count == t->latency_size) {
+        size_t size = t->latency_size ? t->latency_size * 2 : 1 << 16;
+        uint64_t *latency;
+
+        if (size > BENCH_MAX_SAMPLES) return; // enough samples - keep counting, stop timing
+        latency = realloc(t->latency, size * sizeof(*latency));
+        if (!latency) return;
+        t->latency = latency;
+        t->latency_size = size;
+    }
+    t->latency[t->latency_count++] = ns;
+}
+
+// writev() that carries on after a short write. The driver only stops between whole messages
+// (raw writes up to BUFFER_SIZE are never split, framed writes stop between records).
+static int write_messages(int fd, struct iovec *iov, int count, uint64_t *calls) {
+    while (count) {
+        ssize_t n = writev(fd, iov, count);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        (*calls)++;
+        while (count && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (n) {
+            errno = EIO; // stopped inside a message
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void *bench_writer(void *arg) {
+    struct bench_thread *t = arg;
+    struct bench_config *cfg = t->cfg;
+    size_t record = bench_record_size(cfg);
+    char *buffer = calloc(cfg->batch, record);
+    struct iovec iov[BENCH_MAX_BATCH];
+    int fd = open(t->device, O_WRONLY);
+    uint32_t seq = 0;
+
+    if (fd < 0 || !buffer) {
+        perror(t->device);
+        exit(1);
+    }
+    pin_to_cpu(t->cpu);
+
+    // one iovec per message, the driver sees the whole batch in one call
+    for (int i = 0; i < cfg->batch; i++) {
+        uint32_t len = cfg->size;
+
+        if (cfg->framed) memcpy(buffer + i * record, &len, sizeof(len));
+        iov[i].iov_base = buffer + i * record;
+        iov[i].iov_len = record;
+    }
+
+    while (!bench_stop) {
+        uint64_t now = now_ns();
+
+        for (int i = 0; i < cfg->batch; i++) {
+            struct bench_msg msg = { .send_ns = now, .writer = t->index, .seq = seq++ };
+
+            memcpy(buffer + i * record + (record - cfg->size), &msg, sizeof(msg));
+        }
+        if (write_messages(fd, iov, cfg->batch, &t->calls) < 0) {
+            perror("Failed to write to device");
+            exit(1);
+        }
+        t->messages += cfg->batch;
+        t->bytes += cfg->batch * cfg->size;
+    }
+
+    free(buffer);
+    close(fd);
+    return NULL;
+}
+
+void *bench_reader(void *arg) {
+    struct bench_thread *t = arg;
+    struct bench_config *cfg = t->cfg;
+    size_t record = bench_record_size(cfg);
+    // Raw reads ask for whole messages only, so with every write a whole number of messages
+    // a read never splits one between two readers. Framed reads get whole records anyway.
+    size_t read_size = cfg->framed ? (record > BENCH_READ_SIZE ? record : BENCH_READ_SIZE) : cfg->batch * record;
+    char *buffer = malloc(read_size);
+    struct pollfd pfd = { .events = POLLIN };
+
+    pfd.fd = open(t->device, O_RDONLY | O_NONBLOCK);
+    if (pfd.fd < 0 || !buffer) {
+        perror(t->device);
+        exit(1);
+    }
+    pin_to_cpu(t->cpu);
+
+    while (1) {
+        // Checked before the read: once the writers are done, an empty channel stays empty
+        int done = __atomic_load_n(&bench_writers_done, __ATOMIC_ACQUIRE);
+        ssize_t n = read(pfd.fd, buffer, read_size);
+
+        if (n > 0) {
+            uint64_t now = now_ns();
+
+            t->calls++;
+            for (size_t offset = 0; offset + record <= (size_t)n; offset += record) {
+                struct bench_msg msg;
+                uint32_t len = cfg->size;
+
+                if (cfg->framed) memcpy(&len, buffer + offset, sizeof(len));
+                if (len != cfg->size) {
+                    t->errors++;
+                    break; // lost track of the records
+                }
+                memcpy(&msg, buffer + offset + record - cfg->size, sizeof(msg));
+                if (msg.writer >= (uint32_t)cfg->writers) t->errors++;
+                add_latency(t, now - msg.send_ns);
+                t->messages++;
+                t->bytes += cfg->size;
+            }
+            if (n % record) t->errors++;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            perror("Failed to read from device");
+            exit(1);
+        }
+        if (done) break;
+        poll(&pfd, 1, 100);
+    }
+
+    free(buffer);
+    close(pfd.fd);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *sorted, size_t count, double p) {
+    if (!count) return 0;
+    return sorted[(size_t)(p * (count - 1))] / 1e3;
+}
+
+static void bench_usage(const char *name) {
+    fprintf(stderr, "Usage: %s bench [-w writers] [-r readers] [-c channels] [-s message bytes]\n"
+                    "                 [-b messages per write] [-t seconds] [-p pin to CPUs] [-f framed]\n", name);
+}
+
+int run_bench(int argc, char *argv[]) {
+    struct bench_config cfg = { .writers = 1, .readers = 1, .channels = 1, .size = 64, .batch = 1, .seconds = 5 };
+    static struct bench_thread writers[BENCH_MAX_THREADS], readers[BENCH_MAX_THREADS];
+    static struct device_stats before[MAX_CHANNELS], after[MAX_CHANNELS];
+    static int fds[MAX_CHANNELS];
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    optind = 2; // options come after the "bench" word
+    while ((opt = getopt(argc, argv, "w:r:c:s:b:t:pf")) != -1) {
+        switch (opt) {
+            case 'w': cfg.writers = atoi(optarg); break;
+            case 'r': cfg.readers = atoi(optarg); break;
+            case 'c': cfg.channels = atoi(optarg); break;
+            case 's': cfg.size = strtoul(optarg, NULL, 10); break;
+            case 'b': cfg.batch = atoi(optarg); break;
+            case 't': cfg.seconds = atoi(optarg); break;
+            case 'p': cfg.pin = 1; break;
+            case 'f': cfg.framed = 1; break;
+            default: bench_usage(argv[0]); return 1;
+        }
+    }
+    if (cfg.writers < 1 || cfg.writers > BENCH_MAX_THREADS || cfg.readers < 1 || cfg.readers > BENCH_MAX_THREADS ||
+        cfg.channels < 1 || cfg.channels > MAX_CHANNELS || cfg.channels > cfg.writers || cfg.channels > cfg.readers ||
+        cfg.size < sizeof(struct bench_msg) || cfg.size > (1 << 20) ||
+        cfg.batch < 1 || cfg.batch > BENCH_MAX_BATCH || cfg.seconds < 1) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+    if (!cfg.framed && cfg.size * cfg.batch > BUFFER_SIZE) {
+        fprintf(stderr, "Without -f a write of %d messages must fit in %d bytes so it is never split\n",
+                cfg.batch, BUFFER_SIZE);
+        return 1;
+    }
+
+    // Put every channel in the right mode and take the driver's counters
+    for (int i = 0; i < cfg.channels; i++) {
+        char path[64];
+
+        channel_path(path, sizeof(path), i);
+        fds[i] = open(path, O_RDONLY);
+        if (fds[i] < 0) {
+            perror(path);
+            return 1;
+        }
+        if (ioctl(fds[i], IOCTL_SET_FRAMING, &cfg.framed) < 0) {
+            perror("Failed to set framing (is the channel empty?)");
+            return 1;
+        }
+        if (ioctl(fds[i], IOCTL_GET_STATS, &before[i]) < 0) {
+            perror("IOCTL failed");
+            return 1;
+        }
+    }
+
+    // Writers get the first CPUs and readers the next ones
+    for (int i = 0; i < cfg.writers; i++) {
+        writers[i].cfg = &cfg;
+        writers[i].index = i;
+        writers[i].cpu = cfg.pin ? i % ncpus : -1;
+        channel_path(writers[i].device, sizeof(writers[i].device), i % cfg.channels);
+    }
+    for (int i = 0; i < cfg.readers; i++) {
+        readers[i].cfg = &cfg;
+        readers[i].index = i;
+        readers[i].cpu = cfg.pin ? (cfg.writers + i) % ncpus : -1;
+        channel_path(readers[i].device, sizeof(readers[i].device), i % cfg.channels);
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < cfg.readers; i++) pthread_create(&readers[i].thread, NULL, bench_reader, &readers[i]);
+    for (int i = 0; i < cfg.writers; i++) pthread_create(&writers[i].thread, NULL, bench_writer, &writers[i]);
+
+    sleep(cfg.seconds);
+    bench_stop = 1;
+    for (int i = 0; i < cfg.writers; i++) pthread_join(writers[i].thread, NULL);
+    __atomic_store_n(&bench_writers_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < cfg.readers; i++) pthread_join(readers[i].thread, NULL);
+    double elapsed = (now_ns() - start) / 1e9;
+
+    uint64_t sent = 0, write_calls = 0, received = 0, read_calls = 0, bytes = 0, errors = 0;
+    unsigned int driver_writes = 0, driver_reads = 0;
+    size_t samples = 0;
+
+    for (int i = 0; i < cfg.writers; i++) {
+        sent += writers[i].messages;
+        write_calls += writers[i].calls;
+    }
+    for (int i = 0; i < cfg.readers; i++) {
+        received += readers[i].messages;
+        read_calls += readers[i].calls;
+        bytes += readers[i].bytes;
+        errors += readers[i].errors;
+        samples += readers[i].latency_count;
+    }
+    for (int i = 0; i < cfg.channels; i++) {
+        int raw = 0;
+
+        if (ioctl(fds[i], IOCTL_GET_STATS, &after[i]) < 0) {
+            perror("IOCTL failed");
+            return 1;
+        }
+        driver_writes += (unsigned int)after[i].write_count - (unsigned int)before[i].write_count;
+        driver_reads += (unsigned int)after[i].read_count - (unsigned int)before[i].read_count;
+        ioctl(fds[i], IOCTL_SET_FRAMING, &raw); // back to a byte stream for the other modes
+        close(fds[i]);
+    }
+
+    // All readers' latencies together
+    uint64_t *latency = malloc((samples ? samples : 1) * sizeof(*latency));
+    size_t count = 0;
+
+    if (!latency) {
+        perror("malloc");
+        return 1;
+    }
+    for (int i = 0; i < cfg.readers; i++) {
+        memcpy(latency + count, readers[i].latency, readers[i].latency_count * sizeof(*latency));
+        count += readers[i].latency_count;
+        free(readers[i].latency);
+    }
+    qsort(latency, count, sizeof(*latency), cmp_u64);
+
+    int counts_match = driver_writes == write_calls && driver_reads == read_calls;
+
+    printf("bench: %d writers, %d readers, %d channel(s), %zu byte messages, %d per write, %s%s, %d s\n",
+           cfg.writers, cfg.readers, cfg.channels, cfg.size, cfg.batch, cfg.framed ? "framed" : "byte stream",
+           cfg.pin ? ", pinned" : "", cfg.seconds);
+    printf("sent       %llu msgs in %llu writes\n", (unsigned long long)sent, (unsigned long long)write_calls);
+    printf("received   %llu msgs in %llu reads, %llu lost, %llu malformed\n", (unsigned long long)received,
+           (unsigned long long)read_calls, (unsigned long long)(sent - received), (unsigned long long)errors);
+    printf("throughput %.0f msgs/s, %.2f MB/s\n", received / elapsed, bytes / elapsed / (1 << 20));
+    printf("latency    p50 %.1f us  p90 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n",
+           percentile_us(latency, count, 0.5), percentile_us(latency, count, 0.9),
+           percentile_us(latency, count, 0.99), percentile_us(latency, count, 0.999),
+           percentile_us(latency, count, 1.0));
+    printf("driver     %u writes, %u reads counted - %s\n", driver_writes, driver_reads,
+           counts_match ? "matches" : "MISMATCH (is something else using the device?)");
+
+    free(latency);
+    return sent != received || errors || !counts_match ? 2 : 0;
+}
+
+int main(int argc, char *argv[]) {
     int fd;
     struct device_stats stats;
 
+    // ./user_app_2 bench [options] is the load generator, see run_bench
+    if (argc > 1 && !strcmp(argv[1], "bench")) return run_bench(argc, argv);
+
+    // ./user_app_2 splice|copy [MB [channels]] measures bulk throughput instead of running the demo
+    if (argc > 1) {
+        size_t megabytes = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+        int nchannels = argc > 3 ? atoi(argv[3]) : 1;
+
+        if ((strcmp(argv[1], "splice") && strcmp(argv[1], "copy")) || !megabytes ||
+            nchannels < 1 || nchannels > MAX_CHANNELS) {
+            fprintf(stderr, "Usage: %s [splice|copy [MB per channel [channels]]]\n", argv[0]);
+            bench_usage(argv[0]);
+            return 1;
+        }
+        return run_transfer(!strcmp(argv[1], "splice"), megabytes, nchannels) ? 1 : 0;
+    }
+
     fd = open(DEVICE_PATH, O_RDONLY);
     if (fd < 0) {
         perror("Failed to open device");